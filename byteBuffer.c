@@ -0,0 +1,52 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "byteBuffer.h"
+
+void byteBufferConstruct(ByteBuffer* b)
+{
+    b->data = NULL;
+    b->size = 0;
+    b->capacity = 0;
+}
+
+void byteBufferDestruct(ByteBuffer* b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->size = 0;
+    b->capacity = 0;
+}
+
+/**
+ * 确保缓冲区至少能容纳size字节。容量按倍数增长，使追加的均摊代价为O(1)。
+ */
+void byteBufferReserve(ByteBuffer* b, size_t size)
+{
+    if (size <= b->capacity) return;
+    size_t capacity = b->capacity ? b->capacity : 4096;
+    while (capacity < size) capacity *= 2;
+    b->data = realloc(b->data, capacity);
+    b->capacity = capacity;
+}
+
+void byteBufferPrintf(ByteBuffer* b, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(b->data + b->size, b->capacity - b->size, format, args);
+    va_end(args);
+    if (b->size + length >= b->capacity) // 空间不够，扩大后重新输出
+    {
+        byteBufferReserve(b, b->size + length + 1);
+        va_start(args, format);
+        vsnprintf(b->data + b->size, b->capacity - b->size, format, args);
+        va_end(args);
+    }
+    b->size += length;
+}
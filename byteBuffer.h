@@ -0,0 +1,46 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_BYTEBUFFER_H
+#define JDVPDF_BYTEBUFFER_H
+
+#include <stddef.h>
+#include <string.h>
+
+// 可增长的内存缓冲区
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+void byteBufferConstruct(ByteBuffer*);
+void byteBufferDestruct(ByteBuffer*);
+void byteBufferReserve(ByteBuffer*, size_t);
+void byteBufferPrintf(ByteBuffer*, const char*, ...) __attribute__((format(printf, 2, 3)));
+
+inline static void byteBufferClear(ByteBuffer* b)
+{
+    b->size = 0;
+}
+
+inline static void byteBufferWrite(ByteBuffer* b, const void* data, size_t size)
+{
+    if (b->size + size > b->capacity) byteBufferReserve(b, b->size + size);
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+inline static void byteBufferPuts(ByteBuffer* b, const char* str)
+{
+    byteBufferWrite(b, str, strlen(str));
+}
+
+inline static void byteBufferPutc(ByteBuffer* b, char c)
+{
+    if (b->size == b->capacity) byteBufferReserve(b, b->size + 1);
+    b->data[b->size++] = c;
+}
+
+#endif //JDVPDF_BYTEBUFFER_H
@@ -0,0 +1,137 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "byteSink.h"
+
+// 用fwrite输出的ByteSinkWriter，context为FILE*
+int byteSinkWriteFile(void* file, const void* data, size_t size)
+{
+    return fwrite(data, 1, size, file) == size;
+}
+
+/**
+ * 输出到文件。
+ * @param file 为NULL时只在内存中生成
+ */
+void byteSinkConstruct(ByteSink* s, FILE* file)
+{
+    byteSinkConstructWriter(s, file ? byteSinkWriteFile : NULL, file);
+}
+
+/**
+ * 输出到任意目标。
+ * @param write 输出函数，为NULL时只在内存中生成
+ * @param context 传给write的第一个参数
+ */
+void byteSinkConstructWriter(ByteSink* s, ByteSinkWriter write, void* context)
+{
+    byteBufferConstruct(&s->buffer);
+    s->write = write;
+    s->context = context;
+    s->flushed = 0;
+    s->failed = 0;
+    if (write) byteBufferReserve(&s->buffer, BYTE_SINK_CAPACITY);
+}
+
+// 写出缓冲区中剩余的内容并释放缓冲区。不关闭文件。
+void byteSinkDestruct(ByteSink* s)
+{
+    byteSinkFlush(s);
+    byteBufferDestruct(&s->buffer);
+}
+
+void byteSinkFlush(ByteSink* s)
+{
+    if (!s->write || s->buffer.size == 0) return;
+    if (!s->failed && !s->write(s->context, s->buffer.data, s->buffer.size)) s->failed = 1;
+    s->flushed += s->buffer.size;
+    s->buffer.size = 0;
+}
+
+// 不经缓冲区，直接写入大块内容
+void byteSinkWriteLarge(ByteSink* s, const void* data, size_t size)
+{
+    byteSinkFlush(s);
+    if (!s->failed && !s->write(s->context, data, size)) s->failed = 1;
+    s->flushed += size;
+}
+
+void byteSinkPrintf(ByteSink* s, const char* format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) // 格式有误，不应发生
+    {
+        s->failed = 1;
+        return;
+    }
+    if ((size_t) length < sizeof(line))
+    {
+        byteSinkWrite(s, line, length);
+        return;
+    }
+    char* p = byteSinkReserve(s, length + 1);
+    va_start(args, format);
+    vsnprintf(p, length + 1, format, args);
+    va_end(args);
+    byteSinkCommit(s, length);
+}
+
+// 两位十进制数字
+static const char digitPairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+// 按十进制写入整数，代替printf的%u
+void byteSinkPutUnsigned(ByteSink* s, uint64_t val)
+{
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    while (val >= 100)
+    {
+        p -= 2;
+        memcpy(p, digitPairs + (val % 100) * 2, 2);
+        val /= 100;
+    }
+    if (val >= 10)
+    {
+        p -= 2;
+        memcpy(p, digitPairs + val * 2, 2);
+    }
+    else
+        *--p = (char) ('0' + val);
+    byteSinkWrite(s, p, digits + sizeof(digits) - p);
+}
+
+void byteSinkPutSigned(ByteSink* s, int64_t val)
+{
+    if (val < 0)
+    {
+        byteSinkPutc(s, '-');
+        byteSinkPutUnsigned(s, -(uint64_t) val);
+    }
+    else
+        byteSinkPutUnsigned(s, val);
+}
+
+void byteSinkPadZero(ByteSink* s, size_t size)
+{
+    memset(byteSinkReserve(s, size), 0, size);
+    byteSinkCommit(s, size);
+}
@@ -0,0 +1,107 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_BYTESINK_H
+#define JDVPDF_BYTESINK_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "byteBuffer.h"
+
+// 把一块内容交给输出目标，如写入文件。成功时返回1，出错时返回0，此后不再被调用
+typedef int (*ByteSinkWriter)(void*, const void*, size_t);
+
+/*
+ * 输出用的缓冲层。内容先写入buffer，满BYTE_SINK_CAPACITY时整块交给write；
+ * 已输出的字节数由自身记录，不需要ftell。
+ * write为NULL时所有内容都留在buffer中，用于先在内存中生成再编码的stream，或在内存中生成整个文件。
+ * write出错后不再调用，之后的内容都被丢弃，由failed记录，在最后检查即可。
+ */
+typedef struct {
+    ByteBuffer buffer;
+    ByteSinkWriter write;
+    void* context; // write的第一个参数
+    uint64_t flushed; // 已交给write的字节数
+    _Bool failed; // write是否出过错
+} ByteSink;
+
+#define BYTE_SINK_CAPACITY (1 << 20)
+
+void byteSinkConstruct(ByteSink*, FILE*);
+void byteSinkConstructWriter(ByteSink*, ByteSinkWriter, void*);
+int byteSinkWriteFile(void*, const void*, size_t);
+void byteSinkDestruct(ByteSink*);
+void byteSinkFlush(ByteSink*);
+void byteSinkWriteLarge(ByteSink*, const void*, size_t);
+void byteSinkPrintf(ByteSink*, const char*, ...) __attribute__((format(printf, 2, 3)));
+void byteSinkPutUnsigned(ByteSink*, uint64_t);
+void byteSinkPutSigned(ByteSink*, int64_t);
+void byteSinkPadZero(ByteSink*, size_t);
+
+// 已输出（包括仍在缓冲区中）的总字节数
+inline static uint64_t byteSinkOffset(const ByteSink* s)
+{
+    return s->flushed + s->buffer.size;
+}
+
+// 丢弃内存中的内容，只用于write为NULL时
+inline static void byteSinkClear(ByteSink* s)
+{
+    s->buffer.size = 0;
+}
+
+/**
+ * 保证缓冲区中还能写入size字节，返回写入的位置。写入后须调用byteSinkCommit。
+ */
+inline static char* byteSinkReserve(ByteSink* s, size_t size)
+{
+    if (s->write && s->buffer.size + size > BYTE_SINK_CAPACITY) byteSinkFlush(s);
+    if (s->buffer.size + size > s->buffer.capacity) byteBufferReserve(&s->buffer, s->buffer.size + size);
+    return s->buffer.data + s->buffer.size;
+}
+
+inline static void byteSinkCommit(ByteSink* s, size_t size)
+{
+    s->buffer.size += size;
+}
+
+inline static void byteSinkWrite(ByteSink* s, const void* data, size_t size)
+{
+    if (s->write && size >= BYTE_SINK_CAPACITY)
+    {
+        byteSinkWriteLarge(s, data, size);
+        return;
+    }
+    memcpy(byteSinkReserve(s, size), data, size);
+    byteSinkCommit(s, size);
+}
+
+inline static void byteSinkPuts(ByteSink* s, const char* str)
+{
+    byteSinkWrite(s, str, strlen(str));
+}
+
+inline static void byteSinkPutc(ByteSink* s, char c)
+{
+    *byteSinkReserve(s, 1) = c;
+    byteSinkCommit(s, 1);
+}
+
+/**
+ * 按大端序写入无符号整数。
+ * @param size 字节数（1～8）
+ */
+inline static void byteSinkPutBE(ByteSink* s, uint64_t val, int size)
+{
+    uint8_t* p = (uint8_t*) byteSinkReserve(s, size);
+    for (int i=size-1; i>=0; --i)
+    {
+        p[i] = (uint8_t) val;
+        val >>= 8;
+    }
+    byteSinkCommit(s, size);
+}
+
+#endif //JDVPDF_BYTESINK_H
@@ -6,165 +6,167 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cffReader.h"
 #include "endianIO.h"
 
-void cffHeaderExtract(FILE* file, CffHeader* OUT_cffHeader)
+void cffHeaderExtract(const uint8_t* data, CffHeader* OUT_cffHeader)
 {
-    fread(&OUT_cffHeader->major, sizeof(Card8), 1, file);
-    fread(&OUT_cffHeader->minor, sizeof(Card8), 1, file);
-    fread(&OUT_cffHeader->hdrSize, sizeof(Card8), 1, file);
-    fread(&OUT_cffHeader->offSize, sizeof(OffSize), 1, file);
+    OUT_cffHeader->major = data[0];
+    OUT_cffHeader->minor = data[1];
+    OUT_cffHeader->hdrSize = data[2];
+    OUT_cffHeader->offSize = data[3];
 }
 
-void cffIndexExtract(FILE* file, CffIndex* OUT_cffIndex)
+void cffIndexExtract(const uint8_t* data, CffIndex* OUT_cffIndex)
 {
-    assert(file != NULL);
+    assert(data != NULL);
     assert(OUT_cffIndex != NULL);
 
-    Card16 count;
-    OffSize offSize;
-
-    OUT_cffIndex->file = file;
-
-    long sectionBegin = ftell(file);
-    count = readUnsignedFromFileBE(file, sizeof(count));
-    if (count == 0)
-    {
-        offSize = 0;
-    }
-    else
+    Card16 count = readUnsignedBE(data, sizeof(count));
+    OffSize offSize = 0;
+    data += sizeof(count);
+    if (count != 0)
     {
-        offSize = readUnsignedFromFileBE(file, sizeof(offSize));
+        offSize = *data;
+        data += sizeof(offSize);
     }
 
     OUT_cffIndex->count = count;
     OUT_cffIndex->offSize = offSize;
-    long offsetArrayInFile = ftell(file);
-    OUT_cffIndex->offsetArrayInFile = offsetArrayInFile;
-    OUT_cffIndex->objectArrayInFile = offsetArrayInFile + count * offSize;
+    OUT_cffIndex->offsetArray = data;
+    // the offset array has count + 1 entries
+    OUT_cffIndex->objectArray = data + (count + 1) * offSize - 1;
+}
+
+int cffIndexExtractChecked(const uint8_t* data, const uint8_t* end, CffIndex* OUT_cffIndex)
+{
+    assert(data != NULL);
+    assert(end != NULL);
+    assert(OUT_cffIndex != NULL);
+
+    if (data > end || end - data < 2) return 0;
+    Card16 count = readUnsignedBE(data, sizeof(count));
+    if (count != 0 && (end - data < 3 || data[2] < 1 || data[2] > 4)) return 0;
+    cffIndexExtract(data, OUT_cffIndex);
+    if (count == 0) return 1;
+
+    // 各偏移量从1开始，不减小，最后一个对象不超出范围
+    OffSize offSize = OUT_cffIndex->offSize;
+    const uint8_t* p = OUT_cffIndex->offsetArray;
+    if ((size_t) (end - p) < ((size_t) count + 1) * offSize) return 0;
+    if (readUnsignedBE(p, offSize) != 1) return 0;
+    Offset previous = 1;
+    for (size_t i = 1; i <= count; ++i)
+    {
+        Offset current = readUnsignedBE(p + i * offSize, offSize);
+        if (current < previous) return 0;
+        previous = current;
+    }
+    return previous <= (size_t) (end - OUT_cffIndex->objectArray);
 }
 
-void cffIndexFindObject(CffIndex* cffIndex, size_t indexInArr, long* OUT_beginOffset, long* OUT_length)
+void cffIndexFindObject(const CffIndex* cffIndex, size_t indexInArr, const uint8_t** OUT_begin, long* OUT_length)
 {
     assert(cffIndex != NULL);
-    assert(OUT_beginOffset != NULL);
+    assert(OUT_begin != NULL);
     assert(OUT_length != NULL);
 
-    assert(0 <= indexInArr && indexInArr < cffIndex->count);
+    assert(indexInArr < cffIndex->count);
 
-    FILE* file = cffIndex->file;
     OffSize offSize = cffIndex->offSize;
+    const uint8_t* p = cffIndex->offsetArray + indexInArr * offSize;
 
-    fseek(file, cffIndex->offsetArrayInFile + indexInArr * offSize, SEEK_SET);
-
-    // Note: these offsets begin from 1
-    Offset offsetBegin = readUnsignedFromFileBE(file, offSize); 
-    Offset offsetEnd = readUnsignedFromFileBE(file, offSize); // begin of the next is end of this
+    Offset offsetBegin = readUnsignedBE(p, offSize);
+    Offset offsetEnd = readUnsignedBE(p + offSize, offSize); // begin of the next is end of this
 
     *OUT_length = offsetEnd - offsetBegin;
-    *OUT_beginOffset = offsetBegin - 1 + cffIndex->objectArrayInFile;
+    *OUT_begin = cffIndex->objectArray + offsetBegin;
 }
 
-long cffIndexGetSize(CffIndex* cffIndex)
+const uint8_t* cffIndexSkip(const CffIndex* cffIndex)
 {
     assert(cffIndex != NULL);
 
     if (cffIndex->count == 0)
     {
-        return sizeof(cffIndex->count);
+        return cffIndex->offsetArray;
     }
 
-    FILE* file = cffIndex->file;
-    OffSize offSize = cffIndex->offSize;
-
-    size_t offArrLength = cffIndex->count * offSize;
-    fseek(file, cffIndex->offsetArrayInFile + offArrLength, SEEK_SET);
-    size_t bodyLength = readUnsignedFromFileBE(file, offSize) - 1;
-    
-    return 
-        sizeof(cffIndex->count) +
-        sizeof(cffIndex->offSize) +
-        offArrLength +
-        bodyLength;
+    // Note: offset begins from 1
+    Offset offsetEnd = readUnsignedBE(cffIndex->offsetArray + cffIndex->count * cffIndex->offSize, cffIndex->offSize);
+    return cffIndex->objectArray + offsetEnd;
 }
 
-void cffIndexSkip(CffIndex* cffIndex)
+long cffIndexGetSize(const CffIndex* cffIndex)
 {
     assert(cffIndex != NULL);
 
-    if (cffIndex->count == 0)
-    {
-        fseek(cffIndex->file, cffIndex->offsetArrayInFile, SEEK_SET);
-        return;
-    }
-
-    FILE* file = cffIndex->file;
-    OffSize offSize = cffIndex->offSize;
-
-    fseek(file, cffIndex->offsetArrayInFile + cffIndex->count * offSize, SEEK_SET);
-    // Note: offset begins from 1
-    Offset offsetEnd = readUnsignedFromFileBE(file, offSize);
-    fseek(file, cffIndex->objectArrayInFile + offsetEnd - 1, SEEK_SET);
+    const uint8_t* begin = cffIndex->offsetArray - (cffIndex->count == 0 ? sizeof(Card16) : sizeof(Card16) + sizeof(OffSize));
+    return cffIndexSkip(cffIndex) - begin;
 }
 
-static int32_t readDictInt(int32_t current, FILE* f)
+static int32_t readDictInt(int32_t current, const uint8_t** p)
 {
-    if (current < 30)
+    const uint8_t* data = *p;
+    if (current == 28) // 28时为2位
     {
-        size_t numBytes = 1u << (current - 27); // 28时为2位，29时为4位
-        return readUnsignedFromFileBE(f, numBytes);
+        *p += 2;
+        return (int16_t) readUnsignedBE(data, 2);
     }
-    else if (current < 247) current -= 139; // 一字节
-    else // 二字节
+    if (current == 29) // 29时为4位
     {
-        if (current < 251)
-            current = (current - 247 << 8) + 108;
-        else current = (251 - current << 8) - 108;
-        current += fgetc(f);
+        *p += 4;
+        return (int32_t) readUnsignedBE(data, 4);
     }
-    return current;
+    if (current < 247) return current - 139; // 一字节
+    // 二字节
+    ++*p;
+    if (current < 251) return ((current - 247) << 8) + 108 + *data;
+    return -((current - 251) << 8) - 108 - *data;
 }
 
 /**
  * 从Top DICT INDEX中读取Top DICT的内容。by 懒懒
  */
-void cffDictConstruct(FILE* file, long dictLength, CffDict* OUT_cffDict)
+void cffDictConstruct(const uint8_t* data, long dictLength, CffDict* OUT_cffDict)
 {
-    assert(file != NULL);
+    assert(data != NULL);
     assert(OUT_cffDict != NULL);
 
-    long beginOffset = ftell(file);
     // 数据和命令至少1字节，因此项数不会超过字节数
-
     OUT_cffDict->begin = (CffDictItem*)malloc(dictLength * sizeof(CffDictItem));
     CffDictItem* current = OUT_cffDict->begin;
 
-    for (long i = 0; i < dictLength; i = ftell(file) - beginOffset)
+    const uint8_t* end = data + dictLength;
+    for (const uint8_t* p = data; p < end;)
     {
-        int32_t curByte = fgetc(file);
+        int32_t curByte = *p++;
         if (curByte < 22) // operator
         {
             current->type = CFF_DICT_COMMAND;
             if (curByte == 12) // 两字节
-                current->content.data = 0xC00 + fgetc(file);
+            {
+                if (p == end) break;
+                current->content.data = 0xC00 + *p++;
+            }
             else current->content.data = curByte;
         }
         else if (curByte == 30) // 浮点数
         {
             current->type = CFF_DICT_REAL;
-            long curPos = ftell(file);
-            while ((curByte % 16) != 15) curByte = fgetc(file);
-            long length = ftell(file) - curPos;
+            const uint8_t* realBegin = p;
+            while ((curByte % 16) != 15 && p < end) curByte = *p++;
+            long length = p - realBegin;
             current->content.str = malloc(length);
-            fseek(file, curPos, SEEK_SET);
-            fread(current->content.str, 1, length, file);
+            memcpy(current->content.str, realBegin, length);
         }
         else // 整数
         {
+            if (end - p < (curByte == 28 ? 2 : curByte == 29 ? 4 : curByte < 247 ? 0 : 1)) break;
             current->type = CFF_DICT_INTEGER;
-            current->content.data = readDictInt(curByte, file);
+            current->content.data = readDictInt(curByte, &p);
         }
         ++current;
     }
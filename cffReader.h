@@ -7,8 +7,8 @@
 #ifndef JDVPDF_CFFREADER_H
 #define JDVPDF_CFFREADER_H
 
+#include <stddef.h>
 #include <stdint.h>
-#include <stdio.h>
 
 #include "cffCommon.h"
 
@@ -22,65 +22,68 @@ typedef struct
 
 /**
  * Extracts a header
- * Note: affects the file cursor!
- * @param file the file where the header exists
+ * @param data the first byte of the header
  * @param OUT_cffHeader an out parameter. yields the header
  */
-void cffHeaderExtract(FILE* file, CffHeader* OUT_cffHeader);
+void cffHeaderExtract(const uint8_t* data, CffHeader* OUT_cffHeader);
 
-// An info type for dealing with an INDEX structure in CFF
+// An info type for dealing with an INDEX structure in CFF, which is in memory
 typedef struct
 {
-    FILE* file;
     Card16 count;
     OffSize offSize;
-    long offsetArrayInFile; // file offset
-    long objectArrayInFile; // file offset
+    const uint8_t* offsetArray;
+    const uint8_t* objectArray; // the byte before the first object, since offsets begin from 1
 } CffIndex;
 
 /**
  * Extracts information of an INDEX
- * Note: affects the file cursor!
- * @param file the file where the INDEX exists
- * @param OUT_cffIndex an out parameter. yields information for seeking objects in the INDEX.
+ * @param data the first byte of the INDEX
+ * @param OUT_cffIndex an out parameter. yields information for locating objects in the INDEX.
  */
-void cffIndexExtract(FILE* file, CffIndex* OUT_cffIndex);
+void cffIndexExtract(const uint8_t* data, CffIndex* OUT_cffIndex);
+
+/**
+ * Extracts information of an INDEX, checking that the whole INDEX lies before the given end
+ * @param data the first byte of the INDEX
+ * @param end the byte after the available data
+ * @param OUT_cffIndex an out parameter. yields information for locating objects in the INDEX.
+ * @returns 1 if the INDEX is well-formed, 0 otherwise
+ */
+int cffIndexExtractChecked(const uint8_t* data, const uint8_t* end, CffIndex* OUT_cffIndex);
 
 /**
  * Finds the place of an object in an INDEX
- * Note: affects the file cursor!
  * @param cffIndex the INDEX structure to access
  * @param indexInArr the index of the object in the offset array
- * @param OUT_beginOffset an out parameter. yields the object's beginning offset in file
+ * @param OUT_begin an out parameter. yields the first byte of the object
  * @param OUT_length an out parameter. yields the length of the object
  */
-void cffIndexFindObject(CffIndex* cffIndex, size_t indexInArr, long* OUT_beginOffset, long* OUT_length);
+void cffIndexFindObject(const CffIndex* cffIndex, size_t indexInArr, const uint8_t** OUT_begin, long* OUT_length);
 
 /**
  * Gets the physical size of the INDEX structure
- * Note: affects the file cursor!
  * @param cffIndex the INDEX structure whose size is to be got
  * @returns the size of the INDEX
  */
-long cffIndexGetSize(CffIndex* cffIndex);
+long cffIndexGetSize(const CffIndex* cffIndex);
 
 /**
- * Skips the given INDEX
- * Note: affects the file cursor!
+ * Gets the end of the given INDEX, i.e. where the next structure begins
  * @param cffIndex the INDEX structure to skip
+ * @returns the byte after the INDEX
  */
-void cffIndexSkip(CffIndex* cffIndex);
+const uint8_t* cffIndexSkip(const CffIndex* cffIndex);
 
 /**
- * Constructs a DICT from a file
- * Note: affects the file cursor!
+ * Constructs a DICT from memory. An item cut off by the end of the dict is dropped.
  * Note: the CffDict should be properly destructed later!
  * Author: 懒懒
- * @param file the file where the dict exists
- * @param size the size of the dict in file
+ * @param data the first byte of the dict
+ * @param size the size of the dict
  * @param OUT_cffDict an out parameter. yields the cffDict
  */
-void cffDictConstruct(FILE* file, long size, CffDict* OUT_cffDict);
+void cffDictConstruct(const uint8_t* data, long size, CffDict* OUT_cffDict);
 
 /**
  * Destructs a CffDict
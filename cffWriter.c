@@ -8,6 +8,7 @@
 #include "endianIO.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 CffObjectNode* cffObjectNodeNew(size_t size)
@@ -33,14 +34,13 @@ CffObjectNode* cffObjectNodeFromDict(CffDict* cffDict)
     return node;
 }
 
-CffObjectNode* cffObjectNodeFromFile(FILE* file, long begin, size_t size)
+CffObjectNode* cffObjectNodeFromMemory(const void* begin, size_t size)
 {
-    assert(file != NULL);
+    assert(begin != NULL);
     assert(size != 0);
 
     CffObjectNode* ret = cffObjectNodeNew(size);
-    fseek(file, begin, SEEK_SET);
-    fread(ret->ext.data, 1, size, file);
+    memcpy(ret->ext.data, begin, size);
     return ret;
 }
 
@@ -54,6 +54,7 @@ void cffIndexModelConstruct(CffIndexModel* model)
 {
     assert(model != NULL);
 
+    model->size = 0;
     model->count = 0;
     model->head = NULL;
     model->tail = NULL;
@@ -92,17 +93,18 @@ void cffIndexModelAppend(CffIndexModel* model, CffObjectNode* node)
     }
 }
 
-void cffIndexModelAppendEmpty(CffIndexModel* model)
+void cffIndexModelAppendEmpty(CffIndexModel* model, size_t count)
 {
     assert(model != NULL);
-    ++model->count;
+    if (count == 0) return;
+    model->count += count;
 
     if (!model->head || model->tail->size != 0)
     {
         CffObjectNode* node = (CffObjectNode*)malloc(sizeof(CffObjectNode));
         node->size = 0;
         node->next = NULL;
-        node->ext.emptyNodeCount = 1;
+        node->ext.emptyNodeCount = count;
         if (!model->head)
         {
             model->head = node;
@@ -116,34 +118,32 @@ void cffIndexModelAppendEmpty(CffIndexModel* model)
     }
     else
     {
-        ++model->tail->ext.emptyNodeCount;
+        model->tail->ext.emptyNodeCount += count;
     }
 }
 
-void cffIndexModelWriteToFile(CffIndexModel* model, FILE* file)
+void cffIndexModelWriteToSink(const CffIndexModel* model, ByteSink* sink)
 {
-    writeUnsignedToFileBE(file, model->count, sizeof(Card16)); // Card16 count
+    byteSinkPutBE(sink, model->count, sizeof(Card16)); // Card16 count
     OffSize offSize = cffCalcOffSize(model->size + 1); // Note: see cffIndexModelCalcSize
-    writeUnsignedToFileBE(file, offSize, sizeof(offSize)); // OffSize offSize
+    byteSinkPutBE(sink, offSize, sizeof(offSize)); // OffSize offSize
 
     // Write offset array
     Offset currentOffset = 1;
     for (CffObjectNode* it = model->head; it; it = it->next)
     {
-        for (;;)
-        {
-            writeUnsignedToFileBE(file, currentOffset, offSize);
-            if (it->size != 0) break;
-            if (--it->ext.emptyNodeCount == 0) break;
-        }
+        // a node of empty objects stands for emptyNodeCount equal offsets; the model is left intact
+        uintptr_t repeat = it->size != 0 ? 1 : it->ext.emptyNodeCount;
+        for (uintptr_t i = 0; i < repeat; ++i)
+            byteSinkPutBE(sink, currentOffset, offSize);
         currentOffset += it->size;
     }
-    writeUnsignedToFileBE(file, currentOffset, offSize); // "+ 1" in "offset[count + 1]"
+    byteSinkPutBE(sink, currentOffset, offSize); // "+ 1" in "offset[count + 1]"
 
     // Write objects
     for (CffObjectNode* it = model->head; it; it = it->next)
     {
-        if (it->size != 0) fwrite(it->ext.data, 1, it->size, file);
+        if (it->size != 0) byteSinkWrite(sink, it->ext.data, it->size);
     }
 } 
 
@@ -167,12 +167,15 @@ long cffDictCalcSize(CffDict* cffDict)
                 length += 3;
             else length += 5; // 五字节
         }
-        else if (p->type == CFF_DICT_REAL) // 实数，字节数不定
+        else if (p->type == CFF_DICT_REAL) // 实数，字节数不定（含开头的30）
+        {
+            ++length;
             for (uint8_t* c = p->content.str;; ++c)
             {
                 ++length;
                 if (*c % 16 == 15) break;
             }
+        }
     }
     return length;
 }
@@ -204,24 +207,24 @@ size_t cffDictWriteItem(void* out, CffDictItem* item)
         }
         else if (d >= 108 && d <= 1131)
         {
-            o[diff++] = d / 256 + 247;
-            o[diff++] = d % 256 - 108;
+            o[diff++] = (d - 108) / 256 + 247;
+            o[diff++] = (d - 108) % 256;
         }
-        else if (d <= 108 && d >= -1131)
+        else if (d <= -108 && d >= -1131)
         {
-            o[diff++] = (-d) / 256 + 251;
-            o[diff++] = (-d) + 108;
+            o[diff++] = (-d - 108) / 256 + 251;
+            o[diff++] = (-d - 108) % 256;
         }
         else if (d >= -32768 && d <= 32767)
         {
             o[diff++] = 28;
-            o[diff++] = d >> 8;
+            o[diff++] = (d >> 8) & 0xFF;
             o[diff++] = d & 0xFF;
         }
-        else if (d >= -0x80000000 && d <= 0x80000000 - 1)
+        else
         {
             o[diff++] = 29;
-            o[diff++] = d >> 24;
+            o[diff++] = (d >> 24) & 0xFF;
             o[diff++] = (d >> 16) & 0xFF;
             o[diff++] = (d >> 8) & 0xFF;
             o[diff++] = d & 0xFF;
@@ -232,11 +235,12 @@ size_t cffDictWriteItem(void* out, CffDictItem* item)
     case CFF_DICT_REAL:
     {
         uint8_t* it = item->content.str;
+        o[diff++] = 30;
         do
         {
-            o[diff++] = it++;
+            o[diff++] = *it;
         } 
-        while (*it & 0x0F != 0x0F);
+        while ((*it++ & 0x0F) != 0x0F);
     }
     break;
 
@@ -12,6 +12,7 @@
 #include <assert.h>
 
 #include "cffCommon.h"
+#include "byteSink.h"
 
 /**
  * Caculates the offSize to be used according to a max offset
@@ -51,15 +52,13 @@ CffObjectNode* cffObjectNodeNew(size_t size);
 CffObjectNode* cffObjectNodeFromDict(CffDict* cffDict);
 
 /**
- * Creates an object node from a slice of file
+ * Creates an object node from a copy of a slice of memory
  * Note: the return value should be properly freed!
- * Note: affects the file cursor!
- * @param file the file where the slice exists
  * @param begin the beginning of the slice
  * @param size the size of the slice
  * @returns A pointer to the newly created object node
  */
-CffObjectNode* cffObjectNodeFromFile(FILE* file, long begin, size_t size);
+CffObjectNode* cffObjectNodeFromMemory(const void* begin, size_t size);
 
 /**
  * Frees an object node
@@ -97,10 +96,11 @@ void cffIndexModelDestruct(CffIndexModel* model);
 void cffIndexModelAppend(CffIndexModel* model, CffObjectNode* node);
 
 /**
- * Appends an empty object to an INDEX model
+ * Appends empty objects to an INDEX model. Consecutive empty objects share one node.
  * @param model the model to be appended to
+ * @param count the number of empty objects
  */
-void cffIndexModelAppendEmpty(CffIndexModel* model);
+void cffIndexModelAppendEmpty(CffIndexModel* model, size_t count);
 
 /**
  * Calculates the estimated size of an INDEX
@@ -129,11 +129,12 @@ inline long cffIndexModelCalcSize(CffIndexModel* model)
 }
 
 /**
- * Writes the INDEX structure to file in proper format
+ * Writes the INDEX structure to an output sink in proper format. The model is not changed,
+ * so it can be written more than once
  * @param model INDEX model to be written
- * @param file file to be written to
+ * @param sink sink to be written to
  */
-void cffIndexModelWriteToFile(CffIndexModel* model, FILE* file);
+void cffIndexModelWriteToSink(const CffIndexModel* model, ByteSink* sink);
 
 /**
  * Calculates the actual size of a DICT
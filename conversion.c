@@ -0,0 +1,38 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fontObject.h"
+#include "conversion.h"
+
+/**
+ * 初始化转换的状态：没有打开的文件，也没有定义任何字体。
+ */
+void conversionInit(Conversion* c)
+{
+    memset(c, 0, sizeof(Conversion));
+    c->paperWidth = 595;
+    c->paperHeight = 842;
+}
+
+/**
+ * 释放转换占用的内存和输入文件。字体属于字体库，不在此释放。
+ */
+void conversionDestruct(Conversion* c)
+{
+    jdvFileClose(&c->inFile);
+    byteBufferDestruct(&c->output.buffer); // 不再输出，此时输出目标可能已经关闭
+    fontMapDestruct(&c->fontMap);
+    free(c->pageOffset);
+    free(c->xref);
+    free(c->pageObjs);
+    byteSinkDestruct(&c->objectBody);
+    byteSinkDestruct(&c->objStmOffsets);
+    byteSinkDestruct(&c->objStmObjects);
+    memset(c, 0, sizeof(Conversion));
+}
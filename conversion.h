@@ -0,0 +1,51 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_CONVERSION_H
+#define JDVPDF_CONVERSION_H
+
+#include "jdvCursor.h"
+#include "fontMap.h"
+#include "byteSink.h"
+#include "streamEncoder.h"
+
+/*
+ * 一次转换（一个JDV文件到一个PDF文件）的全部状态，由读入、解释页面和输出PDF的各函数共用。
+ * 各转换之间只共用只读的字体库，因此不同的转换可以在不同线程中同时进行。
+ */
+typedef struct {
+    // 读入的JDV文件
+    JdvFile inFile;
+    JdvStream inStream; // 流式读入时使用
+    size_t streamPos; // 流式读入时下一条尚未处理的命令的位置
+    size_t pageEnd; // 流式读入时上一页EOP之后的位置
+    int numPage; // JDV文件中的总页数；流式读入时为已读到的页数
+    uint32_t* pageOffset; // 各页BOP的位置
+    int paperWidth;
+    int paperHeight;
+    double jdvScale; // 每个JDV单位合多少bp
+    FontMap fontMap;
+
+    // 输出的PDF文件
+    ByteSink output;
+    StreamEncoder streamEncoder; // 用于所有stream
+    _Bool useObjectStreams;
+    _Bool outputFailed; // 生成对象流或写入时出错，输出的文件不完整
+    unsigned objCount; // 已分配的对象编号数
+    struct XrefEntry* xref; // 下标为对象编号
+    unsigned xrefCapacity;
+    ByteSink objectBody; // 正在生成的非stream对象
+    ByteSink objStmOffsets; // 对象流开头的各“编号 位置”对
+    ByteSink objStmObjects; // 对象流中各对象的内容
+    unsigned objStmNum; // 当前对象流的编号
+    unsigned objStmCount; // 当前对象流中的对象数
+    int numOutputPage; // 已输出的页数
+    unsigned* pageObjs; // 已输出的各页面对象的编号，供最后输出Pages
+    int pageObjCapacity;
+} Conversion;
+
+void conversionInit(Conversion*);
+void conversionDestruct(Conversion*);
+
+#endif //JDVPDF_CONVERSION_H
@@ -0,0 +1,295 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fontCache.h"
+#include "byteBuffer.h"
+
+/*
+ * 缓存文件的格式：CacheHeader，其后是各条记录。每条记录为CacheRecord，
+ * 其后依次为路径（不含结尾的0）、numTables个表索引（tag、checkSum、offset、length各4字节）
+ * 及numGlyphs个字形宽度（各2字节）。各项不对齐，读取时复制出来。
+ */
+struct CacheHeader {
+    char magic[8];
+    uint32_t recordSize; // sizeof(struct CacheRecord)，结构改变后旧的缓存不再使用
+    uint32_t byteOrder;
+};
+
+struct CacheRecord {
+    uint32_t size; // 整条记录的字节数
+    int32_t index;
+    uint64_t fileSize;
+    int64_t mtime;
+    uint16_t pathLength;
+    uint16_t numTables;
+    uint16_t numGlyphs;
+    uint16_t numHMetrics;
+    uint16_t unitsPerEm;
+    uint16_t ROS;
+    int16_t BBox[4];
+    int16_t ascent;
+    int16_t descent;
+    int16_t capsHeight;
+    uint8_t isOTF;
+    uint8_t isCID;
+    char CIDFontName[64];
+};
+
+static const struct CacheHeader cacheHeader = {"JDVFONT1", sizeof(struct CacheRecord), 0x01020304};
+
+static char* cachePath; // 为NULL时不使用缓存
+static ByteBuffer cache; // 缓存文件的内容，加上本次新载入的字体
+static _Bool cacheChanged;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+inline static size_t recordSize(const struct CacheRecord* r)
+{
+    return sizeof(struct CacheRecord) + r->pathLength + r->numTables * 16u + r->numGlyphs * 2u;
+}
+
+/**
+ * 检查记录中的各项，使由缓存载入的字体与由字体文件解析的满足同样的条件。
+ * @param available 记录开始处之后的字节数
+ * @return 记录完整且各项都在范围内时为1
+ */
+static int recordValid(const struct CacheRecord* r, size_t available)
+{
+    return r->size == recordSize(r) && r->size <= available && r->pathLength > 0 &&
+            r->numGlyphs >= 1 && r->numHMetrics >= 1 && r->numHMetrics <= r->numGlyphs && r->unitsPerEm != 0 &&
+            r->ROS / 256 < 5 && r->isOTF <= 1 && r->isCID <= 1 && memchr(r->CIDFontName, 0, sizeof(r->CIDFontName)) != NULL;
+}
+
+// 文件的修改时间（纳秒）
+inline static int64_t modificationTime(const struct stat* st)
+{
+    return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static char* defaultCachePath()
+{
+    const char* path = getenv("JDVPDF_FONT_CACHE");
+    if (path) return *path ? strdup(path) : NULL;
+    const char* dir = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char* result;
+    if (dir && *dir)
+    {
+        result = malloc(strlen(dir) + 32);
+        sprintf(result, "%s/jdvpdf-fonts.cache", dir);
+    }
+    else if (home && *home)
+    {
+        result = malloc(strlen(home) + 32);
+        sprintf(result, "%s/.cache/jdvpdf-fonts.cache", home);
+    }
+    else result = NULL;
+    return result;
+}
+
+/**
+ * 读入缓存文件。文件不存在或格式不对时从空的缓存开始。
+ */
+void fontCacheOpen()
+{
+    byteBufferConstruct(&cache);
+    cacheChanged = 0;
+    cachePath = defaultCachePath();
+    if (!cachePath) return;
+
+    int fd = open(cachePath, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(struct CacheHeader))
+    {
+        byteBufferReserve(&cache, st.st_size);
+        ssize_t got;
+        while (cache.size < (size_t) st.st_size &&
+                (got = read(fd, cache.data + cache.size, st.st_size - cache.size)) > 0)
+            cache.size += got;
+    }
+    if (fd >= 0) close(fd);
+
+    // 检查各记录，有任何不对时整个丢弃
+    int valid = cache.size >= sizeof(struct CacheHeader) && !memcmp(cache.data, &cacheHeader, sizeof(struct CacheHeader));
+    for (size_t pos = sizeof(struct CacheHeader); valid && pos < cache.size;)
+    {
+        struct CacheRecord r;
+        valid = cache.size - pos >= sizeof(r);
+        if (!valid) break;
+        memcpy(&r, cache.data + pos, sizeof(r));
+        valid = recordValid(&r, cache.size - pos);
+        pos += r.size;
+    }
+    if (!valid)
+    {
+        byteBufferClear(&cache);
+        byteBufferWrite(&cache, &cacheHeader, sizeof(struct CacheHeader));
+    }
+}
+
+/**
+ * 有新载入的字体时写回缓存文件，并释放缓存。字体文件已删除或已改变的记录不再写回。
+ * 先写入临时文件再改名，以免其他进程读到不完整的文件。
+ */
+void fontCacheClose()
+{
+    if (cachePath && cacheChanged)
+    {
+        ByteBuffer out;
+        byteBufferConstruct(&out);
+        byteBufferWrite(&out, &cacheHeader, sizeof(struct CacheHeader));
+        for (size_t pos = sizeof(struct CacheHeader); pos < cache.size;)
+        {
+            struct CacheRecord r;
+            memcpy(&r, cache.data + pos, sizeof(r));
+            char* path = strndup(cache.data + pos + sizeof(r), r.pathLength);
+            struct stat st;
+            if (stat(path, &st) == 0 && (uint64_t) st.st_size == r.fileSize && modificationTime(&st) == r.mtime)
+                byteBufferWrite(&out, cache.data + pos, r.size);
+            free(path);
+            pos += r.size;
+        }
+
+        char* slash = strrchr(cachePath, '/');
+        if (slash && slash != cachePath) // 目录（如~/.cache）可能还不存在
+        {
+            *slash = 0;
+            mkdir(cachePath, 0755);
+            *slash = '/';
+        }
+        char* tempPath = malloc(strlen(cachePath) + 8);
+        sprintf(tempPath, "%s.XXXXXX", cachePath);
+        int fd = mkstemp(tempPath);
+        if (fd >= 0)
+        {
+            size_t written = 0;
+            ssize_t n;
+            while (written < out.size && (n = write(fd, out.data + written, out.size - written)) > 0)
+                written += n;
+            close(fd);
+            if (written != out.size || rename(tempPath, cachePath) != 0) unlink(tempPath);
+        }
+        free(tempPath);
+        byteBufferDestruct(&out);
+    }
+    byteBufferDestruct(&cache);
+    free(cachePath);
+    cachePath = NULL;
+}
+
+/**
+ * 在缓存中查找字体。f->file须已映射，其大小和修改时间须与记录一致。
+ * 找到时填入表索引（指向f->file中的映射）、字体名、ROS、FontDescriptor用的数值、
+ * unitsPerEm、numGlyphs和numHMetrics；T0FontName和advances不填。
+ * @param dir 字体文件路径
+ * @param index TTC中的字体序号
+ * @param advances 输出各字形的宽度，由调用者释放
+ * @return 找到时为1
+ */
+int fontCacheFind(const char* dir, int index, Font* f, uint16_t** advances)
+{
+    if (!cachePath) return 0;
+    size_t pathLength = strlen(dir);
+    int found = 0;
+    pthread_mutex_lock(&cacheLock);
+    for (size_t pos = sizeof(struct CacheHeader); pos < cache.size;)
+    {
+        struct CacheRecord r;
+        memcpy(&r, cache.data + pos, sizeof(r));
+        const char* p = cache.data + pos + sizeof(r);
+        pos += r.size;
+        if (r.index != index || r.pathLength != pathLength || memcmp(p, dir, pathLength) ||
+                r.fileSize != f->file->size || r.mtime != f->file->mtime)
+            continue;
+
+        p += pathLength;
+        f->numTables = r.numTables;
+        f->tableRecords = malloc(r.numTables * sizeof(struct FontTableRecord));
+        for (uint16_t i = 0; i < r.numTables; ++i, p += 16)
+        {
+            struct FontTableRecord* t = f->tableRecords + i;
+            memcpy(&t->tableTag, p, 4);
+            memcpy(&t->checkSum, p + 4, 4);
+            memcpy(&t->offset, p + 8, 4);
+            memcpy(&t->length, p + 12, 4);
+            t->data = f->file->data + t->offset;
+            if ((uint64_t) t->offset + t->length > f->file->size) break;
+        }
+        if (p != cache.data + pos - r.numGlyphs * 2u) // 表超出文件范围，文件被换成了同样大小的
+        {
+            free(f->tableRecords);
+            continue;
+        }
+        *advances = malloc(r.numGlyphs * sizeof(uint16_t));
+        memcpy(*advances, p, r.numGlyphs * sizeof(uint16_t));
+
+        f->isOTF = r.isOTF;
+        f->isCID = r.isCID;
+        memcpy(f->CIDFontName, r.CIDFontName, sizeof(f->CIDFontName));
+        f->ROS = r.ROS;
+        memcpy(f->BBox, r.BBox, sizeof(f->BBox));
+        f->ascent = r.ascent;
+        f->descent = r.descent;
+        f->capsHeight = r.capsHeight;
+        f->unitsPerEm = r.unitsPerEm;
+        f->numGlyphs = r.numGlyphs;
+        f->numHMetrics = r.numHMetrics;
+        found = 1;
+        break;
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return found;
+}
+
+/**
+ * 把刚从字体文件中载入的字体加入缓存，关闭时写回。
+ * @param dir 字体文件路径
+ * @param index TTC中的字体序号
+ */
+void fontCacheAdd(const char* dir, int index, const Font* f)
+{
+    if (!cachePath) return;
+    struct CacheRecord r;
+    memset(&r, 0, sizeof(r));
+    r.index = index;
+    r.fileSize = f->file->size;
+    r.mtime = f->file->mtime;
+    r.pathLength = strlen(dir);
+    r.numTables = f->numTables;
+    r.numGlyphs = f->numGlyphs;
+    r.numHMetrics = f->numHMetrics;
+    r.unitsPerEm = f->unitsPerEm;
+    r.ROS = f->ROS;
+    memcpy(r.BBox, f->BBox, sizeof(r.BBox));
+    r.ascent = f->ascent;
+    r.descent = f->descent;
+    r.capsHeight = f->capsHeight;
+    r.isOTF = f->isOTF;
+    r.isCID = f->isCID;
+    memcpy(r.CIDFontName, f->CIDFontName, sizeof(r.CIDFontName));
+    r.size = recordSize(&r);
+
+    pthread_mutex_lock(&cacheLock);
+    byteBufferWrite(&cache, &r, sizeof(r));
+    byteBufferWrite(&cache, dir, r.pathLength);
+    for (uint16_t i = 0; i < f->numTables; ++i)
+    {
+        const struct FontTableRecord* t = f->tableRecords + i;
+        byteBufferWrite(&cache, &t->tableTag, 4);
+        byteBufferWrite(&cache, &t->checkSum, 4);
+        byteBufferWrite(&cache, &t->offset, 4);
+        byteBufferWrite(&cache, &t->length, 4);
+    }
+    byteBufferWrite(&cache, f->advances, f->numGlyphs * sizeof(uint16_t));
+    cacheChanged = 1;
+    pthread_mutex_unlock(&cacheLock);
+}
@@ -0,0 +1,23 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_FONTCACHE_H
+#define JDVPDF_FONTCACHE_H
+
+#include "fontObject.h"
+
+/*
+ * 保存在磁盘上的字体信息缓存：表索引、字体名、ROS、FontDescriptor用的数值及各字形的宽度，
+ * 按路径和TTC中的序号查找，字体文件的大小或修改时间改变后即失效。
+ * 缓存文件为$JDVPDF_FONT_CACHE，未设置时为$XDG_CACHE_HOME或~/.cache中的jdvpdf-fonts.cache；
+ * JDVPDF_FONT_CACHE为空字符串时不使用缓存。文件按本机字节序保存，只在本机使用。
+ */
+
+void fontCacheOpen();
+void fontCacheClose();
+
+int fontCacheFind(const char*, int, Font*, uint16_t**);
+void fontCacheAdd(const char*, int, const Font*);
+
+#endif //JDVPDF_FONTCACHE_H
@@ -0,0 +1,106 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fontObject.h"
+#include "fontMap.h"
+
+inline static uint32_t hashNumber(int32_t number)
+{
+    uint32_t h = (uint32_t) number * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+/**
+ * 释放映射中的所有项（不释放其中的字体），使之恢复为空映射。
+ */
+void fontMapDestruct(FontMap* m)
+{
+    for (int i=0; i<m->numEntries; ++i)
+    {
+        free(m->entries[i]->usedGlyphs);
+        free(m->entries[i]->path);
+        free(m->entries[i]);
+    }
+    free(m->entries);
+    free(m->slots);
+    memset(m, 0, sizeof(FontMap));
+}
+
+/**
+ * 取得字体号对应的字体，第一次使用时才从字体库中载入，从未选定的字体不会被打开。
+ * 各页可能在不同线程中同时解释，因此用原子操作；同时载入同一字体时由字体库合并为一次。
+ * @return 无法载入时为NULL
+ */
+Font* fontTableFont(struct FontTable* t)
+{
+    Font* f = __atomic_load_n(&t->font, __ATOMIC_ACQUIRE);
+    if (f) return f;
+    f = fontFromFile(t->path, t->index);
+    if (f) __atomic_store_n(&t->font, f, __ATOMIC_RELEASE);
+    return f;
+}
+
+struct FontTable* fontMapFindSparse(const FontMap* m, int32_t number)
+{
+    if (!m->slots) return NULL;
+    for (uint32_t i = hashNumber(number) & m->slotMask;; i = (i + 1) & m->slotMask)
+    {
+        struct FontTable* t = m->slots[i];
+        if (!t || t->number == number) return t;
+    }
+}
+
+// 把散列表扩大一倍，保持装填因子不超过1/2
+static void growSlots(FontMap* m)
+{
+    uint32_t capacity = m->slots ? (m->slotMask + 1) * 2 : 16;
+    struct FontTable** slots = calloc(capacity, sizeof(struct FontTable*));
+    for (uint32_t i=0; m->slots && i<=m->slotMask; ++i)
+    {
+        struct FontTable* t = m->slots[i];
+        if (!t) continue;
+        uint32_t j = hashNumber(t->number) & (capacity - 1);
+        while (slots[j]) j = (j + 1) & (capacity - 1);
+        slots[j] = t;
+    }
+    free(m->slots);
+    m->slots = slots;
+    m->slotMask = capacity - 1;
+}
+
+/**
+ * 取得字体号对应的项，不存在时新建一个（各字段为0）。
+ * @param number 字体号
+ */
+struct FontTable* fontMapInsert(FontMap* m, int32_t number)
+{
+    struct FontTable* t = fontMapFind(m, number);
+    if (t) return t;
+
+    t = calloc(1, sizeof(struct FontTable));
+    t->number = number;
+    if ((uint32_t) number < FONT_MAP_DENSE_SIZE)
+        m->dense[number] = t;
+    else
+    {
+        if (!m->slots || (m->numSparse + 1) * 2 > m->slotMask + 1) growSlots(m);
+        uint32_t i = hashNumber(number) & m->slotMask;
+        while (m->slots[i]) i = (i + 1) & m->slotMask;
+        m->slots[i] = t;
+        ++m->numSparse;
+    }
+
+    if (m->numEntries == m->entryCapacity)
+    {
+        m->entryCapacity = m->entryCapacity ? m->entryCapacity * 2 : 16;
+        m->entries = realloc(m->entries, m->entryCapacity * sizeof(struct FontTable*));
+    }
+    m->entries[m->numEntries++] = t;
+    return t;
+}
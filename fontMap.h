@@ -0,0 +1,57 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_FONTMAP_H
+#define JDVPDF_FONTMAP_H
+
+#include <stdint.h>
+
+#include "fontObject.h"
+
+// 字体号到字体的对应
+struct FontTable {
+    int32_t number; // 字体号
+    int size;
+    char* path; // 字体文件路径
+    int index; // TTC中的字体序号
+    Font* font; // 第一次被选定时才载入，此前为NULL；用fontTableFont取得
+    unsigned pdfObj; // 输出PDF时该字体的Type0对象编号
+    uint64_t* usedGlyphs; // 页面中用到的字形，供子集化用
+};
+
+// 小于此数的字体号直接按下标查找
+#define FONT_MAP_DENSE_SIZE 256
+
+/*
+ * 字体号到FontTable的映射，没有上限。
+ * 较小的字体号放在数组中，其余的放在开放定址（线性探查）的散列表中。
+ * 另按定义的顺序记录所有项，供输出时遍历。
+ * 全部为0时即为空映射。
+ */
+typedef struct {
+    struct FontTable* dense[FONT_MAP_DENSE_SIZE];
+    struct FontTable** slots; // 散列表，容量为2的幂
+    uint32_t slotMask;
+    uint32_t numSparse;
+    struct FontTable** entries;
+    int numEntries;
+    int entryCapacity;
+} FontMap;
+
+void fontMapDestruct(FontMap*);
+struct FontTable* fontMapInsert(FontMap*, int32_t);
+struct FontTable* fontMapFindSparse(const FontMap*, int32_t);
+Font* fontTableFont(struct FontTable*);
+
+/**
+ * 按字体号查找。
+ * @return 字体号未定义时为NULL
+ */
+inline static struct FontTable* fontMapFind(const FontMap* m, int32_t number)
+{
+    if ((uint32_t) number < FONT_MAP_DENSE_SIZE) return m->dense[number];
+    return fontMapFindSparse(m, number);
+}
+
+#endif //JDVPDF_FONTMAP_H
@@ -7,283 +7,334 @@
 #include <assert.h>
 #include <string.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "fontObject.h"
+#include "fontCache.h"
+#include "cffReader.h"
 #include "endianIO.h"
 
-#define MAX_NUM_FONTS 128
-
 const char* orderings[5] = {"CNS1", "GB1", "Identity", "Japan1", "Korea1"};
 
-inline static void deleteFont(Font* f)
+/*
+ * 从同一文件中解析出的宽度。TTC中的各字体可能共用hmtx表，
+ * 此时按hmtx的位置和字形数找到已经解析的结果。
+ */
+struct SharedMetrics {
+    uint32_t hmtxOffset;
+    uint16_t numHMetrics;
+    uint16_t numGlyphs;
+    uint16_t* advances;
+    struct SharedMetrics* next;
+};
+
+inline static void deleteFontFile(FontFile* file)
 {
-    fclose(f->fontFile);
-    free(f->tableRecords);
+    munmap((void*) file->data, file->size);
+    struct SharedMetrics* current = file->metrics, *next;
+    while (current)
+    {
+        next = current->next;
+        free(current->advances);
+        free(current);
+        current = next;
+    }
 }
 
-// hash table
-struct FontNode {
-    char dir[256];
-    Font current;
-    struct FontNode* next;
+/*
+ * 字体库，以开放定址的散列表保存，容量不足时加倍。
+ * 字体按路径和TTC中的序号查找，字体文件按路径查找（序号为-1），以便TTC中的各字体共用。
+ * 查找时只持有读锁；未找到时在写锁下加入状态为ENTRY_LOADING的项，在锁外载入，
+ * 同时请求同一字体的其他线程等待这次载入完成，而不是各自载入。
+ * 项一经加入就不再移动或释放，直到deleteFontLibrary，因此取得的指针在锁外也有效。
+ */
+#define ENTRY_LOADING   0
+#define ENTRY_LOADED    1
+#define ENTRY_FAILED    2
+
+struct LibraryEntry {
+    uint64_t hash;
+    char* dir;
+    int index;
+    int state; // 用__atomic读写，改变时广播loadDone
+    union {
+        Font font;
+        FontFile file;
+    };
 };
 
-inline static unsigned hashFromString(char* str)
+static struct LibraryEntry** library; // 空位为NULL
+static size_t libraryCapacity; // 2的幂
+static size_t librarySize;
+static pthread_rwlock_t libraryLock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t loadLock = PTHREAD_MUTEX_INITIALIZER; // 等待其他线程载入时使用
+static pthread_cond_t loadDone = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER; // 修改FontFile中的metrics时持有
+
+// 64位FNV-1a，最后混入序号
+inline static uint64_t hashFromString(const char* str, int index)
 {
-    unsigned hash = 0;
+    uint64_t hash = 0xCBF29CE484222325u;
     while (*str)
     {
-        hash *= 31;
-        hash += *str++;
+        hash ^= (uint8_t) *str++;
+        hash *= 0x100000001B3u;
     }
-    return hash % 64;
+    hash ^= (uint32_t) index;
+    hash *= 0x100000001B3u;
+    return hash ^ (hash >> 32);
 }
 
-struct FontNode* fontLibrary[64];
-
+/**
+ * 初始化字体库，并读入磁盘上的字体信息缓存。
+ */
 void initiateFontLibrary()
 {
-    for (int i=0; i<64; ++i) fontLibrary[i] = NULL;
+    library = NULL;
+    libraryCapacity = 0;
+    librarySize = 0;
+    fontCacheOpen();
 }
 
 void deleteFontLibrary()
 {
-    for (int i=0; i<64; ++i)
+    for (size_t i = 0; i < libraryCapacity; ++i)
     {
-        struct FontNode* current = fontLibrary[i], *next;
-        while (current)
+        struct LibraryEntry* e = library[i];
+        if (!e) continue;
+        if (e->state == ENTRY_LOADED)
         {
-            next = current->next;
-            deleteFont(&current->current);
-            free(current);
-            current = next;
+            if (e->index < 0) deleteFontFile(&e->file);
+            else free(e->font.tableRecords);
         }
+        free(e->dir);
+        free(e);
     }
+    free(library);
+    library = NULL;
+    libraryCapacity = 0;
+    librarySize = 0;
+    fontCacheClose();
 }
 
-inline static void switchEndian16(uint16_t* num)
+/**
+ * 在散列表中查找。调用时须持有libraryLock（读写均可）。
+ * @return 项所在的位置，没有时为应插入的空位
+ */
+static size_t probeLibrary(uint64_t hash, const char* dir, int index)
 {
-    static uint8_t c1, c2;
-    c1 = *num & 0xFFu;
-    c2 = (*num & 0xFF00u) >> 8u;
-    *num = (c1 << 8u) + c2;
+    size_t mask = libraryCapacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        struct LibraryEntry* e = library[i];
+        if (!e || (e->hash == hash && e->index == index && !strcmp(e->dir, dir))) return i;
+    }
 }
 
-inline static void switchEndian32(uint32_t* num)
+// 容量加倍，重新放置各项。调用时须持有写锁
+static void growLibrary()
 {
-    static uint8_t c1, c2, c3, c4;
-    c1 = *num & 0xFFu;
-    c2 = (*num & 0xFF00u) >> 8u;
-    c3 = (*num & 0xFF0000u) >> 16u;
-    c4 = (*num & 0xFF000000u) >> 24u;
-    *num = (c1 << 24u) + (c2 << 16u) + (c3 << 8u) + c4;
+    struct LibraryEntry** old = library;
+    size_t oldCapacity = libraryCapacity;
+    libraryCapacity = oldCapacity ? oldCapacity * 2 : 64;
+    library = calloc(libraryCapacity, sizeof(struct LibraryEntry*));
+    for (size_t i = 0; i < oldCapacity; ++i)
+        if (old[i]) library[probeLibrary(old[i]->hash, old[i]->dir, old[i]->index)] = old[i];
+    free(old);
 }
 
-uint16_t findIndexOfTable(Font* obj, const char* tagStr)
+/**
+ * 取得字体库中的项，没有时加入。
+ * @param isNew 输出，为1时调用者须载入该项，再调用finishEntry
+ */
+static struct LibraryEntry* acquireEntry(const char* dir, int index, _Bool* isNew)
 {
-    uint32_t tag = (tagStr[0] << 24) + (tagStr[1] << 16) + (tagStr[2] << 8) + tagStr[3];
-    // 二分查找
-    uint16_t left = 0, right = obj->numTables - 1, mid = (left + right) / 2;
-    while (left < right)
+    uint64_t hash = hashFromString(dir, index);
+    struct LibraryEntry* e = NULL;
+    *isNew = 0;
+
+    pthread_rwlock_rdlock(&libraryLock);
+    if (libraryCapacity) e = library[probeLibrary(hash, dir, index)];
+    pthread_rwlock_unlock(&libraryLock);
+    if (e && __atomic_load_n(&e->state, __ATOMIC_ACQUIRE) != ENTRY_FAILED) return e;
+
+    pthread_rwlock_wrlock(&libraryLock);
+    if ((librarySize + 1) * 4 > libraryCapacity * 3) growLibrary(); // 装填因子不超过3/4
+    size_t pos = probeLibrary(hash, dir, index);
+    e = library[pos];
+    if (!e)
     {
-        uint32_t current = obj->tableRecords[mid].tableTag;
-        if (current == tag) break;
-        if (current > tag) right = mid - 1;
-        else left = mid + 1;
-        mid = (left + right) / 2;
+        e = malloc(sizeof(struct LibraryEntry));
+        e->hash = hash;
+        e->dir = strdup(dir);
+        e->index = index;
+        e->state = ENTRY_LOADING;
+        library[pos] = e;
+        ++librarySize;
+        *isNew = 1;
+    }
+    else if (__atomic_load_n(&e->state, __ATOMIC_ACQUIRE) == ENTRY_FAILED) // 上次未能载入，再试一次
+    {
+        __atomic_store_n(&e->state, ENTRY_LOADING, __ATOMIC_RELEASE);
+        *isNew = 1;
     }
-    return mid;
+    pthread_rwlock_unlock(&libraryLock);
+    return e;
 }
 
-/**
- * 寻找给定Tag的表格偏移量。
- * tagStr必须至少为4字节。
- * @return 以32位无符号整数表示的偏移量
- */
-inline static uint32_t findOffsetOfTable(Font* obj, const char* tagStr)
+// 载入完成后调用，唤醒等待的线程
+static void finishEntry(struct LibraryEntry* e, _Bool loaded)
 {
-    uint16_t index = findIndexOfTable(obj, tagStr);
-    return obj->tableRecords[index].offset;
+    pthread_mutex_lock(&loadLock);
+    __atomic_store_n(&e->state, loaded ? ENTRY_LOADED : ENTRY_FAILED, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&loadDone);
+    pthread_mutex_unlock(&loadLock);
 }
 
-struct NameTableHeader {
-    uint16_t format;
-    uint16_t count;
-    uint16_t stringOffset;
-};
-
-struct NameRecord {
-    uint16_t platformID;
-    uint16_t encodingID;
-    uint16_t languageID;
-    uint16_t nameID;
-    uint16_t length;
-    uint16_t offset;
-};
-
-struct NameTable {
-    struct NameTableHeader header;
-    struct NameRecord* records;
-};
-
 /**
- * 读取字体中的Name表（TTF、OTF通用）。
- * @param fontFile 字体文件
- * @param output 输出到的地址
+ * 等待其他线程载入该项。
+ * @return 载入成功时为1
  */
-void readNameTable(FILE* fontFile, struct NameTable* output)
+static int waitEntry(struct LibraryEntry* e)
 {
-    fread(&output->header, sizeof(struct NameTableHeader), 1, fontFile);
-    switchEndian16(&output->header.count);
-    switchEndian16(&output->header.stringOffset);
-
-    output->records = malloc(output->header.count * sizeof(struct NameRecord));
-    fread(output->records, sizeof(struct NameRecord), output->header.count, fontFile);
-    struct NameRecord* end = output->records + output->header.count;
-    for (struct NameRecord* current = output->records; current != end; ++current)
+    int state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+    if (state == ENTRY_LOADING)
     {
-        switchEndian16(&current->length);
-        switchEndian16(&current->offset);
+        pthread_mutex_lock(&loadLock);
+        while ((state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE)) == ENTRY_LOADING)
+            pthread_cond_wait(&loadDone, &loadLock);
+        pthread_mutex_unlock(&loadLock);
     }
+    return state == ENTRY_LOADED;
 }
 
 /**
- * 从name表中读取Postscript名（TTF用）
- * @param obj 字体文件头的指针
- * @param fontFile 字体文件本身
- * @param output 输出地址，必须有64字节以上的空间
+ * 按Tag查找表，表索引须按Tag排序。
+ * @return 表的序号，没有该表时为numTables
  */
-void getNameTtf(Font* f)
+uint16_t findIndexOfTable(Font* obj, const char* tagStr)
 {
-    FILE* fontFile = f->fontFile;
-    uint32_t offset = findOffsetOfTable(f, "name");
-    fseek(fontFile, offset, SEEK_SET);
-
-    struct NameTable table;
-    readNameTable(fontFile, &table);
-
-    offset += table.header.stringOffset;
-    uint16_t index = 0xFFFFu;
-    // 寻找表示PostScript名的项
-    for (uint16_t i = 0; i < table.header.count; ++i)
-        if (table.records[i].platformID == 0x0300u && table.records[i].nameID == 0x0600u) // 是Postscript名
-        {
-            index = i;
-            break;
-        }
-    fseek(fontFile, offset + table.records[index].offset, SEEK_SET);
-    uint16_t length = table.records[index].length;
-    char* temp = malloc(length);
-    for (uint16_t i = 0; i < length; ++i)
+    uint32_t tag = (tagStr[0] << 24) + (tagStr[1] << 16) + (tagStr[2] << 8) + tagStr[3];
+    // 二分查找，范围为[left, right)
+    uint16_t left = 0, right = obj->numTables;
+    while (left < right)
     {
-        char currentChar = fgetc(fontFile);
-        temp[i] = currentChar;
+        uint16_t mid = (left + right) / 2;
+        uint32_t current = obj->tableRecords[mid].tableTag;
+        if (current == tag) return mid;
+        if (current > tag) right = mid;
+        else left = mid + 1;
     }
-    for (uint16_t i = 1; i < length; i += 2)
-        f->CIDFontName[i / 2] = temp[i];
-    free(temp);
-    f->CIDFontName[length / 2] = '\0';
-    free(table.records);
+    return obj->numTables;
 }
 
-inline static int readIndexInt(int size, FILE* f)
+/**
+ * 寻找给定Tag的表格在映射中的位置。
+ * tagStr必须至少为4字节。
+ * @param minLength 表至少应有的长度
+ * @return 没有该表或表太短时为NULL
+ */
+inline static const uint8_t* findTable(Font* obj, const char* tagStr, uint32_t minLength)
 {
-    int result = 0;
-    for (int i=0; i<size; ++i)
-        result = (result << 8) + fgetc(f);
-    return result;
+    uint16_t index = findIndexOfTable(obj, tagStr);
+    if (index == obj->numTables || obj->tableRecords[index].length < minLength) return NULL;
+    return obj->tableRecords[index].data;
 }
 
 /**
- * 读取CFF字体Dict中用压缩手段保存的数字。
- * @pre 第一字节在正常范围内
- * @param current 已经读取出的第一字节
- * @param f 字体文件
+ * 从name表中读取Postscript名（TTF用）。名字按UTF-16BE保存，只取各字符的低字节。
+ * @param f 字体，结果放在CIDFontName中
+ * @return name表完整时为1
  */
-int readDictInt(int current, FILE* f)
+int getNameTtf(Font* f)
 {
-    if (current < 30)
-    {
-        int numBytes = 1 << (current - 27); // 28时为2位，29时为4位
-        current = 0;
-        for (int i=0; i<numBytes; ++i)
-            current = (current << 8) + fgetc(f);
-    }
-    else if (current == 30) // 坑人的十进制浮点数我懒得做了
-    {
-        while ((current % 16) != 15) current = fgetc(f);
-        current = INT32_MAX;
-    }
-    else if (current < 247) current -= 139; // 一字节
-    else // 二字节
-    {
-        if (current < 251)
-            current = (current - 247 << 8) + 108;
-        else current = (251 - current << 8) - 108;
-        current += fgetc(f);
-    }
-    return current;
+    const uint8_t* table = findTable(f, "name", 6);
+    if (!table) return 0;
+    uint32_t tableLength = f->tableRecords[findIndexOfTable(f, "name")].length;
+    uint16_t count = readUnsignedBE(table + 2, 2);
+    uint16_t stringOffset = readUnsignedBE(table + 4, 2);
+    if (6 + count * 12u > tableLength) return 0;
+    const uint8_t* strings = table + stringOffset;
+    f->CIDFontName[0] = '\0';
+    // 寻找表示PostScript名的项，每项12字节
+    for (const uint8_t* record = table + 6; record < table + 6 + count * 12; record += 12)
+        if (readUnsignedBE(record, 2) == 3 && readUnsignedBE(record + 6, 2) == 6) // 是Postscript名
+        {
+            uint16_t length = readUnsignedBE(record + 8, 2);
+            uint16_t nameOffset = readUnsignedBE(record + 10, 2);
+            if ((uint32_t) stringOffset + nameOffset + length > tableLength) return 0;
+            const uint8_t* name = strings + nameOffset;
+            if (length / 2 >= sizeof(f->CIDFontName)) length = (sizeof(f->CIDFontName) - 1) * 2;
+            for (uint16_t i = 1; i < length; i += 2)
+                f->CIDFontName[i / 2] = name[i];
+            f->CIDFontName[length / 2] = '\0';
+            break;
+        }
+    return 1;
 }
 
-// 读取CFF格式中的字体名，并确定它是否为CID字体
-void getNameCff(Font* f)
+/**
+ * 读取CFF格式中的字体名，并确定它是否为CID字体。
+ * OTF用的CFF中Name INDEX只包括一个名字；CID字体的Top DICT以ROS开头。
+ * @return 读到的各INDEX都在CFF表范围内时为1
+ */
+int getNameCff(Font* f)
 {
-    uint16_t indexCFF = findIndexOfTable(f, "CFF ");
-    uint32_t length = f->tableRecords[indexCFF].length;
-    uint32_t absOffset = f->tableRecords[indexCFF].offset;
-
-    int32_t numStack[3];
-    int stackTop = 0;
-    char buffer[9];
-
-    fseek(f->fontFile, absOffset + 2l, SEEK_SET);
-    uint8_t headerSize = fgetc(f->fontFile);
-    fseek(f->fontFile, headerSize + 1l, SEEK_CUR);
-
-    /*
-     * 读取CFF字体名。OTF用的CFF子集中，Name Index只能包括一个名字，且一定是256字节以内，因此前四个字节一定是00 01 01 01。
-     */
-    int tmp = fgetc(f->fontFile) - 1;
-    fread(f->CIDFontName, tmp, 1, f->fontFile);
-    f->CIDFontName[tmp] = '\0';
-
-    // 确定是不是CID字体
-    fseek(f->fontFile, 2l, SEEK_CUR);
-    tmp = fgetc(f->fontFile); // 偏移量长度
-    fseek(f->fontFile, tmp, SEEK_CUR); // 第1个值必定是1，不用考虑
-    tmp = readIndexInt(tmp, f->fontFile); // Top DICT的长度
-    tmp += ftell(f->fontFile) - 1;
-    while (1)
+    const uint8_t* cff = findTable(f, "CFF ", 4);
+    if (!cff) return 0;
+    const uint8_t* end = cff + f->tableRecords[findIndexOfTable(f, "CFF ")].length;
+    CffIndex index;
+    const uint8_t* p;
+    long length;
+
+    // Name INDEX，紧接在长度为hdrSize的header之后
+    if (!cffIndexExtractChecked(cff + cff[2], end, &index) || index.count == 0) return 0;
+    cffIndexFindObject(&index, 0, &p, &length);
+    if ((size_t) length >= sizeof(f->CIDFontName)) length = sizeof(f->CIDFontName) - 1;
+    memcpy(f->CIDFontName, p, length);
+    f->CIDFontName[length] = '\0';
+
+    // Top DICT INDEX
+    if (!cffIndexExtractChecked(cffIndexSkip(&index), end, &index) || index.count == 0) return 0;
+    const uint8_t* stringIndex = cffIndexSkip(&index);
+    cffIndexFindObject(&index, 0, &p, &length);
+    CffDict topDict;
+    cffDictConstruct(p, length, &topDict);
+    CffDictItem* ros = topDict.begin;
+    if (topDict.end - ros < 4 || ros[3].type != CFF_DICT_COMMAND || ros[3].content.data != 0xC1E ||
+            ros[0].type != CFF_DICT_INTEGER || ros[1].type != CFF_DICT_INTEGER || ros[2].type != CFF_DICT_INTEGER)
     {
-        int cur = fgetc(f->fontFile);
-        if (cur > 27) numStack[stackTop++] = readDictInt(cur, f->fontFile);
-        else if (cur != 12) return;
-        else
-        {
-            cur = fgetc(f->fontFile);
-            if (cur != 30) return;
-            break;
-        }
+        cffDictDestruct(&topDict);
+        return 1;
     }
+
     // 此时该字体必然是CID字体
     f->isCID = 1;
-    fseek(f->fontFile, tmp, SEEK_SET);
-    int numStr = readIndexInt(2, f->fontFile);
-    tmp = fgetc(f->fontFile); // 偏移量长度
-    numStack[1] -= 391; // 预先定义的字符串中并没有CID相关的，因此一定在string dict里
-    fseek(f->fontFile, tmp * numStack[1], SEEK_CUR); // 跳到相应的偏移量处
-    int strOffset = readIndexInt(tmp, f->fontFile); // 字符串偏移量
-    int strLen = readIndexInt(tmp, f->fontFile) - strOffset; // 字符串长度
-    fseek(f->fontFile, tmp * (numStr - numStack[1]) + strOffset - 3, SEEK_CUR); // 跳到字符串的开始
-    fread(buffer, 1, strLen, f->fontFile);
-    buffer[strLen] = 0;
+    char buffer[9] = "";
+    int32_t sid = ros[1].content.data - 391; // 预先定义的字符串中并没有CID相关的，因此一定在String INDEX里
+    if (cffIndexExtractChecked(stringIndex, end, &index) && sid >= 0 && sid < index.count)
+    {
+        cffIndexFindObject(&index, sid, &p, &length);
+        if ((size_t) length < sizeof(buffer))
+        {
+            memcpy(buffer, p, length);
+            buffer[length] = 0;
+        }
+    }
+    f->ROS = 2 << 8; // 不认识的Ordering按Identity处理
     for (int i=0; i<5; ++i)
         if (!strcmp(orderings[i], buffer))
         {
             f->ROS = i << 8;
             break;
         }
-    f->ROS += numStack[2];
+    f->ROS += ros[2].content.data;
+    cffDictDestruct(&topDict);
+    return 1;
 }
 
 // 生成子集化需要的字体名
@@ -305,86 +356,278 @@ inline static void subroutineFontName(Font* f)
     f->CIDFontName[6] = '+';
 }
 
-// 读取FontDescriptor需要的内容
-void readFDContent(Font* f)
+/**
+ * 读取FontDescriptor需要的内容。
+ * 没有OS/2表时按hhea表取ascent和descent；版本2以前的OS/2表中没有sCapHeight，此时以ascent代替。
+ * @return head和hhea表完整时为1
+ */
+int readFDContent(Font* f)
 {
-    uint16_t index = findIndexOfTable(f, "head");
-    uint32_t offset = f->tableRecords[index].offset + 36;
-    fseek(f->fontFile, offset, SEEK_SET);
-    fread(f->BBox, 2, 4, f->fontFile);
+    const uint8_t* head = findTable(f, "head", 54);
+    const uint8_t* hhea = findTable(f, "hhea", 36);
+    if (!head || !hhea) return 0;
     for (int i=0; i<4; ++i)
-        switchEndian16(f->BBox + i);
-
-    index = findIndexOfTable(f, "OS/2");
-    offset = f->tableRecords[index].offset + 68;
-    fseek(f->fontFile, offset, SEEK_SET);
-    f->ascent = readUnsignedFromFileBE(f->fontFile, 2);
-    f->descent = readUnsignedFromFileBE(f->fontFile, 2);
-    fseek(f->fontFile, 16, SEEK_CUR);
-    f->capsHeight = readUnsignedFromFileBE(f->fontFile, 2);
+        f->BBox[i] = readUnsignedBE(head + 36 + 2 * i, 2);
+
+    const uint8_t* os2 = findTable(f, "OS/2", 72);
+    if (os2)
+    {
+        f->ascent = readUnsignedBE(os2 + 68, 2);
+        f->descent = readUnsignedBE(os2 + 70, 2);
+    }
+    else
+    {
+        f->ascent = readUnsignedBE(hhea + 4, 2);
+        f->descent = readUnsignedBE(hhea + 6, 2);
+    }
+    f->capsHeight = f->ascent;
+    if (os2 && readUnsignedBE(os2, 2) >= 2 && findTable(f, "OS/2", 90))
+        f->capsHeight = readUnsignedBE(os2 + 88, 2);
+    return 1;
 }
 
-// 读取SFNT格式的字体
-Font* fontFromFile(char* dir, int index)
+// 在同一文件已解析的hmtx表中查找，没有时为NULL。调用时须持有metricsLock
+static const uint16_t* findSharedMetrics(FontFile* file, uint32_t hmtxOffset, uint16_t numHMetrics, uint16_t numGlyphs)
 {
-    unsigned hash = hashFromString(dir);
-    struct FontNode* current = fontLibrary[hash];
-    // 如果没有这个hash值，自然不会进入循环
-    while (current)
+    for (struct SharedMetrics* m = file->metrics; m; m = m->next)
+        if (m->hmtxOffset == hmtxOffset && m->numHMetrics == numHMetrics && m->numGlyphs == numGlyphs)
+            return m->advances;
+    return NULL;
+}
+
+/**
+ * 使字体使用给定的宽度。同一文件中已有相同的hmtx表时使用已有的，并释放advances。
+ * 同一文件中的另一个字体可能同时在其他线程中载入，因此在锁内再查找一次。
+ * @param advances 各字形的宽度，由malloc分配
+ */
+static void shareMetrics(Font* f, uint16_t* advances)
+{
+    uint16_t index = findIndexOfTable(f, "hmtx");
+    uint32_t hmtxOffset = index < f->numTables ? f->tableRecords[index].offset : 0;
+    pthread_mutex_lock(&metricsLock);
+    f->advances = findSharedMetrics(f->file, hmtxOffset, f->numHMetrics, f->numGlyphs);
+    if (f->advances) free(advances);
+    else
+    {
+        struct SharedMetrics* m = malloc(sizeof(struct SharedMetrics));
+        m->hmtxOffset = hmtxOffset;
+        m->numHMetrics = f->numHMetrics;
+        m->numGlyphs = f->numGlyphs;
+        m->advances = advances;
+        m->next = f->file->metrics;
+        f->file->metrics = m;
+        f->advances = advances;
+    }
+    pthread_mutex_unlock(&metricsLock);
+}
+
+/**
+ * 读取各字形的宽度，解释页面时计算set_char的位移用。
+ * @return 各表完整，且unitsPerEm、字形数和hmtx的项数不为0时为1
+ */
+int readMetrics(Font* f)
+{
+    const uint8_t* head = findTable(f, "head", 20);
+    const uint8_t* maxp = findTable(f, "maxp", 6);
+    const uint8_t* hhea = findTable(f, "hhea", 36);
+    if (!head || !maxp || !hhea) return 0;
+    f->unitsPerEm = readUnsignedBE(head + 18, 2);
+    f->numGlyphs = readUnsignedBE(maxp + 4, 2);
+    f->numHMetrics = readUnsignedBE(hhea + 34, 2);
+    if (f->numHMetrics > f->numGlyphs) f->numHMetrics = f->numGlyphs;
+    if (f->unitsPerEm == 0 || f->numHMetrics == 0) return 0; // 宽度要除以unitsPerEm
+
+    // hmtx表中每项4字节（宽度、左侧空白），其后的字形与最后一项同宽
+    const uint8_t* hmtx = findTable(f, "hmtx", 4u * f->numHMetrics);
+    if (!hmtx) return 0;
+
+    // 同一文件中已有相同的hmtx表时直接使用
+    uint32_t hmtxOffset = hmtx - f->file->data;
+    pthread_mutex_lock(&metricsLock);
+    f->advances = findSharedMetrics(f->file, hmtxOffset, f->numHMetrics, f->numGlyphs);
+    pthread_mutex_unlock(&metricsLock);
+    if (f->advances) return 1;
+
+    uint16_t* advances = malloc(f->numGlyphs * sizeof(uint16_t));
+    for (uint16_t i = 0; i < f->numGlyphs; ++i)
+        advances[i] = i < f->numHMetrics ? readUnsignedBE(hmtx + 4 * i, 2) : advances[i-1];
+    shareMetrics(f, advances);
+    return 1;
+}
+
+/**
+ * 把字形集合转换为按升序排列的GID列表。按64位字扫描，跳过全为0的字。
+ * @param glyphs 字形集合，共GLYPH_SET_WORDS个字
+ * @param output 输出地址，必须能容纳集合中的所有GID
+ * @return GID的个数
+ */
+size_t listGlyphs(const uint64_t* glyphs, uint16_t* output)
+{
+    size_t count = 0;
+    for (uint32_t i = 0; i < GLYPH_SET_WORDS; ++i)
+    {
+        uint64_t word = glyphs[i];
+        while (word)
+        {
+            output[count++] = i * 64 + __builtin_ctzll(word);
+            word &= word - 1; // 去掉最低位的1
+        }
+    }
+    return count;
+}
+
+/**
+ * 把字体文件只读地映射到内存。
+ * @return 成功时为1
+ */
+static int mapFontFile(FontFile* file, const char* dir)
+{
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= 12)
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return 0;
+    file->data = p;
+    file->size = st.st_size;
+    file->mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    file->metrics = NULL;
+    return 1;
+}
+
+/**
+ * 从字体库中取得字体文件，没有时映射到内存。
+ * @return 无法打开时为NULL
+ */
+static FontFile* openFontFile(const char* dir)
+{
+    _Bool isNew;
+    struct LibraryEntry* e = acquireEntry(dir, -1, &isNew);
+    if (isNew)
     {
-        if (!strcmp(current->dir, dir)) return &current->current;
-        current = current->next;
+        _Bool loaded = mapFontFile(&e->file, dir);
+        finishEntry(e, loaded);
+        return loaded ? &e->file : NULL;
     }
-    struct FontNode* new = malloc(sizeof(struct FontNode));
-    // 把新节点加入链表
-    new->next = fontLibrary[hash];
-    fontLibrary[hash] = new;
+    return waitEntry(e) ? &e->file : NULL;
+}
 
-    Font* curFont = &new->current;
-    curFont->fontFile = fopen(dir, "rb");
+/**
+ * 读取表索引，并把各表解析为映射中的指针。
+ * @param header 表索引的开始（TTC中为相应字体的）
+ * @return 表索引完整、各表都在文件范围内时为1
+ */
+static int readTableDirectory(Font* f, const uint8_t* header)
+{
+    const uint8_t* end = f->file->data + f->file->size;
+    if (end - header < 12) return 0;
+    f->numTables = readUnsignedBE(header + 4, 2);
+    if ((size_t) (end - header) < 12 + f->numTables * 16u) return 0;
+    f->tableRecords = malloc(f->numTables * sizeof(struct FontTableRecord));
+    for (uint16_t i = 0; i < f->numTables; ++i)
+    {
+        const uint8_t* p = header + 12 + i * 16;
+        struct FontTableRecord* r = f->tableRecords + i;
+        r->tableTag = readUnsignedBE(p, 4);
+        r->checkSum = readUnsignedBE(p + 4, 4);
+        r->offset = readUnsignedBE(p + 8, 4);
+        r->length = readUnsignedBE(p + 12, 4);
+        if ((uint64_t) r->offset + r->length > f->file->size)
+        {
+            free(f->tableRecords);
+            return 0;
+        }
+        r->data = f->file->data + r->offset;
+    }
+    return 1;
+}
+
+/**
+ * 从字体文件中解析字体。
+ * @param f 输出到的地址，file须已映射
+ * @param index TTC中的字体序号，不是TTC时忽略
+ * @return 成功时为1
+ */
+static int parseFont(Font* f, int index)
+{
+    const uint8_t* data = f->file->data;
+    size_t size = f->file->size;
 
     // 读取magic number，确定是不是OTF字体
-    uint32_t tmp;
-    fread(&tmp, 4, 1, curFont->fontFile);
-    if (tmp == 0x66637474U)
+    const uint8_t* header = data;
+    uint32_t tag = readUnsignedBE(header, 4);
+    if (tag == 0x74746366U) // ttcf
     {
-        fseek(curFont->fontFile, 8l, SEEK_SET);
-        tmp = readUnsignedFromFileBE(curFont->fontFile, 4); // numFonts
-        if (tmp <= index) return NULL;
-        fseek(curFont->fontFile, index * 4l, SEEK_CUR);
-        tmp = readUnsignedFromFileBE(curFont->fontFile, 4); // proper index
-        fseek(curFont->fontFile, tmp, SEEK_SET);
-        fread(&tmp, sizeof(uint32_t), 1, curFont->fontFile);
+        uint32_t numFonts = readUnsignedBE(data + 8, 4);
+        if (numFonts <= (uint32_t) index || size < 12 + 4 * ((size_t) index + 1) ||
+                readUnsignedBE(data + 12 + 4 * index, 4) > size - 4)
+            return 0;
+        header = data + readUnsignedBE(data + 12 + 4 * index, 4);
+        tag = readUnsignedBE(header, 4);
     }
-    curFont->isOTF = tmp == 0x4F54544F;
-    curFont->isCID = 0;
-
-    // 读取各表索引
-    curFont->numTables = readUnsignedFromFileBE(curFont->fontFile, 2);;
-    curFont->tableRecords = malloc(curFont->numTables * sizeof(struct FontTableRecord));
-    fseek(curFont->fontFile, 6l, SEEK_CUR);
-    fread(curFont->tableRecords, sizeof(struct FontTableRecord), curFont->numTables, curFont->fontFile);
-    for (uint32_t* p = (uint32_t*) curFont->tableRecords;
-            p < (uint32_t*) curFont->tableRecords + curFont->numTables;
-            ++p)
-        *p = readUnsignedFromFileBE(curFont->fontFile, 4);
+    if (!readTableDirectory(f, header)) return 0;
+
+    f->isOTF = tag == 0x4F54544F;
+    f->isCID = 0;
 
     // 如果是OTF字体，则使用CFF表内的名字；顺便确定是否为CID字体
-    if (curFont->isOTF) getNameCff(curFont);
     // 如果是TTF字体，则使用name表里的PS名称
-    else getNameTtf(curFont);
-    if (!curFont->isOTF || !curFont->isCID)
-        curFont->ROS = 512; // Adobe-Identity-0
+    // 然后生成将来font descriptor用的内容
+    if (!(f->isOTF ? getNameCff(f) : getNameTtf(f)) || !readFDContent(f) || !readMetrics(f))
+    {
+        free(f->tableRecords);
+        return 0;
+    }
+    if (!f->isOTF || !f->isCID)
+        f->ROS = 512; // Adobe-Identity-0
 
-    //subroutineFontName(curFont);
+    //subroutineFontName(f);
+    return 1;
+}
 
-    // 所有字体统一使用Identity-H的CMap（字符编码到cid/gid已经在排版时完成）
-    strcpy(curFont->T0FontName, curFont->CIDFontName);
-    strcpy(curFont->T0FontName + strlen(curFont->CIDFontName), "-Identity-H");
+/**
+ * 读取SFNT格式的字体。TTC中的各字体共用一个映射，各自只有表索引和由表解析出的数据。
+ * 磁盘上的缓存中有该字体时不必解析各表。
+ * @param f 输出到的地址
+ * @param dir 字体文件路径
+ * @param index TTC中的字体序号，不是TTC时忽略
+ * @return 成功时为1
+ */
+static int loadFont(Font* f, const char* dir, int index)
+{
+    f->file = openFontFile(dir);
+    if (!f->file) return 0;
 
-    // 生成将来font descriptor用的内容
-    readFDContent(curFont);
+    uint16_t* advances;
+    if (fontCacheFind(dir, index, f, &advances)) shareMetrics(f, advances);
+    else if (parseFont(f, index)) fontCacheAdd(dir, index, f);
+    else return 0;
 
-    strcpy(new->dir, dir);
-    return curFont;
+    // 所有字体统一使用Identity-H的CMap（字符编码到cid/gid已经在排版时完成）
+    snprintf(f->T0FontName, sizeof(f->T0FontName), "%s-Identity-H", f->CIDFontName);
+    return 1;
+}
+
+/**
+ * 从字体库中取得字体，没有时载入。可在多个线程中同时调用：
+ * 查找不互相阻塞，同时请求同一个尚未载入的字体时只载入一次。
+ * 字体载入后只读，由各转换共用；字体文件只映射一次（TTC中的各字体共用），各表在映射中直接读取。
+ * @param dir 字体文件路径
+ * @param index TTC中的字体序号，不能为负
+ * @return 无法载入时为NULL
+ */
+Font* fontFromFile(char* dir, int index)
+{
+    if (index < 0) return NULL;
+    _Bool isNew;
+    struct LibraryEntry* e = acquireEntry(dir, index, &isNew);
+    if (isNew)
+    {
+        _Bool loaded = loadFont(&e->font, dir, index);
+        finishEntry(e, loaded);
+        return loaded ? &e->font : NULL;
+    }
+    return waitEntry(e) ? &e->font : NULL;
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #ifndef JDVPDF_FONTOBJECT_H
 #define JDVPDF_FONTOBJECT_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 extern const char* orderings[5];
 
 struct FontTableRecord {
@@ -12,14 +15,28 @@ struct FontTableRecord {
     uint32_t checkSum;
     uint32_t offset;
     uint32_t length;
+    const uint8_t* data; // 映射中该表的开始
 };
 
+struct SharedMetrics;
+
+/*
+ * 只读映射到内存的字体文件，各转换可同时读取。
+ * TTC中的各字体共用同一个映射，它们共用的表（如hmtx）也只解析一次。
+ */
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    int64_t mtime; // 修改时间（纳秒），检查缓存用
+    struct SharedMetrics* metrics; // 已解析的各hmtx表
+} FontFile;
+
 struct _FontObject {
-    FILE* fontFile;
+    FontFile* file;
     _Bool isOTF;
     _Bool isCID;
     char CIDFontName[64];
-    char T0FontName[64];
+    char T0FontName[64 + sizeof("-Identity-H") - 1]; // CIDFontName加上CMap名
     uint16_t numTables;
     struct FontTableRecord* tableRecords;
     // 以下用于PDF输出
@@ -28,6 +45,11 @@ struct _FontObject {
     int16_t ascent;
     int16_t descent;
     int16_t capsHeight;
+    // 以下用于解释页面
+    uint16_t unitsPerEm;
+    uint16_t numGlyphs;
+    uint16_t numHMetrics; // hmtx中完整的项数，其后的字形与最后一项同宽
+    const uint16_t* advances; // 各字形的宽度，属于file，同一TTC中hmtx相同的字体共用
 };
 
 typedef struct _FontObject Font;
@@ -39,4 +61,26 @@ uint16_t findIndexOfTable(Font*, const char*);
 
 Font* fontFromFile(char*, int);
 
+// 记录用到的字形，每个GID占1位
+#define GLYPH_SET_WORDS (65536 / 64)
+
+size_t listGlyphs(const uint64_t*, uint16_t*);
+
+/**
+ * 字形的宽度（以字体单位计）。
+ */
+inline static uint16_t fontGlyphAdvance(const Font* f, uint32_t gid)
+{
+    return gid < f->numGlyphs ? f->advances[gid] : 0;
+}
+
+/**
+ * 字形在PDF中的宽度（以1000为1em），即CIDFont中/W的值。
+ * 页面中的TJ按此宽度计算字距调整，两处必须一致。
+ */
+inline static int fontGlyphWidthPdf(const Font* f, uint32_t gid)
+{
+    return ((int32_t) fontGlyphAdvance(f, gid) * 1000 + f->unitsPerEm / 2) / f->unitsPerEm;
+}
+
 #endif //JDVPDF_FONTOBJECT_H
@@ -14,342 +14,577 @@
 #include "cffWriter.h" // for cff subsetting
 #include "endianIO.h"
 
-extern FILE* outFile;
+// Operators in the Top DICT whose operand is an offset from the beginning of the CFF
+#define CFF_REF_CHARSET     0
+#define CFF_REF_ENCODING    1
+#define CFF_REF_CHARSTRINGS 2
+#define CFF_REF_PRIVATE     3
+#define CFF_REF_FDARRAY     4
+#define CFF_REF_FDSELECT    5
+#define CFF_NUM_REFS        6
 
-inline static void switchEndian32(uint32_t* num)
+static const int32_t cffRefOperators[CFF_NUM_REFS] = {15, 16, 17, 18, 0xC24, 0xC25};
+
+/**
+ * Decodes an integer operand of a DICT in memory
+ * @param p the first byte of the operand
+ * @param OUT_width an out parameter. yields the encoded size of the operand
+ * @returns the value
+ */
+static int32_t cffDecodeDictInt(const uint8_t* p, int* OUT_width)
+{
+    if (p[0] == 28)
+    {
+        *OUT_width = 3;
+        return (int16_t) ((p[1] << 8) | p[2]);
+    }
+    if (p[0] == 29)
+    {
+        *OUT_width = 5;
+        return (int32_t) (((uint32_t) p[1] << 24) | (p[2] << 16) | (p[3] << 8) | p[4]);
+    }
+    if (p[0] < 247)
+    {
+        *OUT_width = 1;
+        return p[0] - 139;
+    }
+    *OUT_width = 2;
+    if (p[0] < 251) return ((p[0] - 247) << 8) + p[1] + 108;
+    return -((p[0] - 251) << 8) - p[1] - 108;
+}
+
+/**
+ * How the structures of a CFF move when the Name, Top DICT, CharStrings and FDArray INDEXes are replaced
+ */
+typedef struct
+{
+    long headShift; // how far the structures before CharStrings move
+    int32_t oldCharStringsOffset;
+    long charStringsSizeDiff; // how much CharStrings INDEX grows
+    int32_t oldFdArrayOffset; // -1 if there is no FDArray
+    long fdArraySizeDiff; // how much FDArray grows
+} CffLayoutShift;
+
+/**
+ * Maps an offset in the original CFF to the offset of the same structure in the subset
+ */
+static int32_t cffShiftOffset(const CffLayoutShift* shift, int32_t offset)
+{
+    return offset + shift->headShift +
+            (offset > shift->oldCharStringsOffset ? shift->charStringsSizeDiff : 0) +
+            (shift->oldFdArrayOffset >= 0 && offset > shift->oldFdArrayOffset ? shift->fdArraySizeDiff : 0);
+}
+
+/**
+ * Copies a Font DICT (in FDArray), moving its Private DICT offset.
+ * The offset is always written in the 5-byte form, so the size of the copy does not depend on the layout.
+ * @param dict the Font DICT in memory
+ * @param size the size of the Font DICT
+ * @param out where the copy is written; NULL to only measure it
+ * @param shift how the structures move; ignored when out is NULL
+ * @returns the size of the copy, or -1 if the Font DICT is malformed
+ */
+static long cffRewriteFontDict(const uint8_t* dict, long size, uint8_t* out, const CffLayoutShift* shift)
 {
-    static uint8_t c1, c2, c3, c4;
-    c1 = *num & 0xFFu;
-    c2 = (*num & 0xFF00u) >> 8u;
-    c3 = (*num & 0xFF0000u) >> 16u;
-    c4 = (*num & 0xFF000000u) >> 24u;
-    *num = (c1 << 24u) + (c2 << 16u) + (c3 << 8u) + c4;
+    const uint8_t* end = dict + size;
+    const uint8_t* lastOperand = NULL;
+    long lastOperandOut = 0, o = 0;
+    for (const uint8_t* p = dict; p < end;)
+    {
+        long width;
+        if (*p < 22) // operator
+        {
+            width = *p == 12 ? 2 : 1;
+            if (*p == 18) // Private: size and offset
+            {
+                if (!lastOperand) return -1;
+                o = lastOperandOut;
+                if (out)
+                {
+                    int operandWidth;
+                    int32_t offset = cffShiftOffset(shift, cffDecodeDictInt(lastOperand, &operandWidth));
+                    out[o] = 29;
+                    for (int i = 0; i < 4; ++i)
+                        out[o + 1 + i] = (uint32_t) offset >> (24 - 8 * i);
+                }
+                o += 5;
+            }
+            lastOperand = NULL;
+        }
+        else if (*p == 30) // real number: up to the byte with the end nibble
+        {
+            const uint8_t* q = p + 1;
+            while (q < end && (*q & 0x0F) != 0x0F && (*q & 0xF0) != 0xF0) ++q;
+            if (q == end) return -1;
+            width = q + 1 - p;
+            lastOperand = NULL;
+        }
+        else
+        {
+            width = *p == 28 ? 3 : *p == 29 ? 5 : *p < 247 ? 1 : 2;
+            lastOperand = p;
+            lastOperandOut = o;
+        }
+        if (end - p < width) return -1;
+        if (out) memcpy(out + o, p, width);
+        o += width;
+        p += width;
+    }
+    return o;
 }
 
-static void fileCopy(FILE* dest, FILE* src, size_t size)
+/**
+ * 输出原CFF中的一段；被替换的INDEX（若在这一段中）用新的INDEX代替。
+ * @param patchAt 被替换的INDEX在原CFF中的位置，没有时为NULL
+ * @param patchSize 被替换的INDEX的长度
+ * @param patch 新的INDEX
+ */
+static void cffWriteRegion(ByteSink* out, const uint8_t* begin, const uint8_t* end,
+                           const uint8_t* patchAt, size_t patchSize, const CffIndexModel* patch)
 {
-    uint8_t buffer[512];
-    while (size != 0)
+    if (patchAt && patchAt >= begin && patchAt + patchSize <= end)
     {
-        size_t diff = size & 512;
-        fread(buffer, 1, diff, src);
-        fwrite(buffer, 1, diff, dest);
-        size -= diff;
+        byteSinkWrite(out, begin, patchAt - begin);
+        cffIndexModelWriteToSink(patch, out);
+        begin = patchAt + patchSize;
     }
+    byteSinkWrite(out, begin, end - begin);
 }
 
 /**
  * 生成一个CFF字体的子集。
+ * 未用到的字形在CharStrings INDEX中保留为空，使GID不变。
  * @param numGID 一共使用的GID数
  * @param GIDs GID列表，以升序排列。
  * @param f 原字体。
+ * @param out 输出到的缓冲层
+ * @return 成功时为1，CFF表中的结构不完整时为0
  */
-void outputSubsetCFF(size_t numGID, uint16_t* GIDs, Font* f)
+int outputSubsetCFF(size_t numGID, uint16_t* GIDs, Font* f, ByteSink* out)
 {
     uint16_t indexCFF = findIndexOfTable(f, "CFF ");
+    if (indexCFF == f->numTables || f->tableRecords[indexCFF].length < 4) return 0;
     uint32_t length = f->tableRecords[indexCFF].length;
-    uint32_t fileBegin = f->tableRecords[indexCFF].offset;
-
-    FILE* file = f->fontFile;
+    const uint8_t* cff = f->tableRecords[indexCFF].data; // 只读，须修改的部分另外复制
+    const uint8_t* cffEnd = cff + length;
 
     // Entry Header
-    fseek(file, fileBegin, SEEK_SET);
     CffHeader header;
-    cffHeaderExtract(file, &header);
+    cffHeaderExtract(cff, &header);
 
     // Entry Name INDEX
     CffIndex oldNameIndex;
-    cffIndexExtract(file, &oldNameIndex);
+    if (!cffIndexExtractChecked(cff + header.hdrSize, cffEnd, &oldNameIndex)) return 0;
     long oldNameIndexSize = cffIndexGetSize(&oldNameIndex);
-    cffIndexSkip(&oldNameIndex);
-
-    CffIndexModel newNameIndex;
-    CffObjectNode* newNameNode = cffObjectNodeNew(strlen(f->CIDFontName));
-    strcpy(newNameNode->ext.data, f->CIDFontName);
-    cffIndexModelAppend(&newNameIndex, newNameNode);
-    long nameIndexSizeDiff = cffIndexModelCalcSize(&newNameIndex) - oldNameIndexSize;
 
     CffDict topDict;
     CffIndex topDictIndex;
-    cffIndexExtract(file, &topDictIndex);
-    long oldTopDictBegin, oldTopDictSize;
-    cffIndexFindObject(&topDictIndex, 0, &oldTopDictBegin, &oldTopDictSize);
-    fseek(file, oldTopDictBegin, SEEK_SET);
-    cffDictConstruct(file, oldTopDictSize, &topDict);
-
-    // According to the Data Layout Chapter,
-    // Encoding and CharStrings INDEXs are before CharStrings,
-    // which means their offsets only rely on the length of the
-    // Top DICT itself;
-    // However, the Private DICT exists after CharStrings INDEX
-    // and thus should be updated according to the CharStrings size
-    // 0 -> pCharsetOffset (15)
-    // 1 -> pEncodingOffset (16)
-    // 2 -> pCharStringsOffset (17)
-    // 3 -> pPrivateOffset (18)
-    int32_t* pRefOffset[4] = {0};
-    const size_t charset = 0, encoding = 1, charStrings = 2, private = 3;
+    if (!cffIndexExtractChecked(cffIndexSkip(&oldNameIndex), cffEnd, &topDictIndex) || topDictIndex.count == 0)
+        return 0;
+    long oldTopDictIndexSize = cffIndexGetSize(&topDictIndex);
+    const uint8_t* oldTopDict;
+    long oldTopDictSize;
+    cffIndexFindObject(&topDictIndex, 0, &oldTopDict, &oldTopDictSize);
+    cffDictConstruct(oldTopDict, oldTopDictSize, &topDict);
+
+    // According to the Data Layout Chapter, the structures before CharStrings
+    // only move with the size of the Name and Top DICT INDEXes;
+    // those after CharStrings (usually Private DICTs, and FDArray in CID fonts)
+    // also move with the size of the new CharStrings INDEX,
+    // and those after FDArray also move with the size of the new FDArray.
+    int32_t* pRefOffset[CFF_NUM_REFS] = {0};
+    int32_t oldRefOffset[CFF_NUM_REFS] = {0};
+    _Bool valid = 1;
     for (CffDictItem* it = topDict.begin; it != topDict.end; ++it)
     {
-        if (it->type == CFF_DICT_COMMAND)
+        if (it->type != CFF_DICT_COMMAND) continue;
+        for (size_t i = 0; i < CFF_NUM_REFS; ++i)
         {
+            if (it->content.data != cffRefOperators[i]) continue;
             CffDictItem* arg = it - 1;
-            int32_t op = it->content.data;
-            if (15 <= op && op <= 18)
+            if (it == topDict.begin || arg->type != CFF_DICT_INTEGER)
             {
-                assert(arg->type == CFF_DICT_INTEGER);
-                pRefOffset[op - 15] = &arg->content.data;
+                valid = 0;
+                continue;
             }
+            pRefOffset[i] = &arg->content.data;
+            oldRefOffset[i] = arg->content.data;
+        }
+    }
+    // charset 0~2 and Encoding 0~1 are predefined ones rather than offsets
+    if (pRefOffset[CFF_REF_CHARSET] && oldRefOffset[CFF_REF_CHARSET] <= 2) pRefOffset[CFF_REF_CHARSET] = NULL;
+    if (pRefOffset[CFF_REF_ENCODING] && oldRefOffset[CFF_REF_ENCODING] <= 1) pRefOffset[CFF_REF_ENCODING] = NULL;
+
+    // CharStrings在Top DICT INDEX之后，其后的部分原样输出。
+    // FDArray整个重新生成（其中的偏移量须修改），因此须完整地在CharStrings之前或之后的一段中
+    long regionBegin = header.hdrSize + oldNameIndexSize + oldTopDictIndexSize;
+    CffLayoutShift shift = {0, oldRefOffset[CFF_REF_CHARSTRINGS], 0, -1, 0};
+    int32_t fdArrayOffset = oldRefOffset[CFF_REF_FDARRAY];
+    CffIndex oldCharStringsIndex, fdArray;
+    valid = valid && pRefOffset[CFF_REF_CHARSTRINGS] && shift.oldCharStringsOffset >= regionBegin &&
+            shift.oldCharStringsOffset < (int64_t) length &&
+            cffIndexExtractChecked(cff + shift.oldCharStringsOffset, cffEnd, &oldCharStringsIndex);
+    long oldCharStringsIndexSize = valid ? cffIndexGetSize(&oldCharStringsIndex) : 0;
+    long oldCharStringsIndexEnd = shift.oldCharStringsOffset + oldCharStringsIndexSize;
+    long oldFdArraySize = 0, newFdDictsSize = 0;
+    if (valid && pRefOffset[CFF_REF_FDARRAY])
+    {
+        valid = fdArrayOffset >= regionBegin && fdArrayOffset < (int64_t) length &&
+                cffIndexExtractChecked(cff + fdArrayOffset, cffEnd, &fdArray) && fdArray.count != 0;
+        if (valid) oldFdArraySize = cffIndexGetSize(&fdArray);
+        valid = valid && (fdArrayOffset + oldFdArraySize <= shift.oldCharStringsOffset ||
+                fdArrayOffset >= oldCharStringsIndexEnd);
+        // 各Font DICT中Private的偏移量写成5字节，新的FDArray的大小与偏移量无关
+        for (size_t i = 0; valid && i < fdArray.count; ++i)
+        {
+            const uint8_t* dictBegin;
+            long dictSize;
+            cffIndexFindObject(&fdArray, i, &dictBegin, &dictSize);
+            long newSize = cffRewriteFontDict(dictBegin, dictSize, NULL, NULL);
+            valid = newSize >= 0;
+            newFdDictsSize += newSize;
+        }
+        if (valid)
+        {
+            shift.oldFdArrayOffset = fdArrayOffset;
+            shift.fdArraySizeDiff = sizeof(Card16) + sizeof(OffSize) +
+                    cffCalcOffSize(newFdDictsSize + 1) * (fdArray.count + 1) + newFdDictsSize - oldFdArraySize;
         }
     }
+    if (!valid)
+    {
+        cffDictDestruct(&topDict);
+        return 0;
+    }
+
+    CffIndexModel newNameIndex;
+    cffIndexModelConstruct(&newNameIndex);
+    size_t nameLength = strlen(f->CIDFontName);
+    cffIndexModelAppend(&newNameIndex, cffObjectNodeFromMemory(f->CIDFontName, nameLength));
+    long nameIndexSizeDiff = cffIndexModelCalcSize(&newNameIndex) - oldNameIndexSize;
 
     // Subsetting CharStrings
-    assert(pRefOffset[charStrings] != NULL);
-    long oldCharStringsIndexBegin = *pRefOffset[charStrings];
-    fseek(file, oldCharStringsIndexBegin, SEEK_SET);
-    CffIndex oldCharStringsIndex;
-    cffIndexExtract(file, &oldCharStringsIndex);
     CffIndexModel newCharStringsIndex;
     cffIndexModelConstruct(&newCharStringsIndex);
-    uint16_t* itPendingGID = GIDs;
-    uint16_t* endPendingGID = GIDs + numGID;
-    for (size_t i = 0; i < oldCharStringsIndex.count; ++i)
+    // Only the kept glyphs are looked up; each gap between them is appended as one run of empty objects
+    size_t nextGID = 0;
+    for (uint16_t* it = GIDs; it != GIDs + numGID && *it < oldCharStringsIndex.count; ++it)
     {
-        if (itPendingGID != endPendingGID && *itPendingGID == i)
+        cffIndexModelAppendEmpty(&newCharStringsIndex, *it - nextGID);
+        nextGID = *it + 1;
+        const uint8_t* objectBegin;
+        long objectLength;
+        cffIndexFindObject(&oldCharStringsIndex, *it, &objectBegin, &objectLength);
+        if (objectLength != 0)
         {
-            ++itPendingGID;
-            long objectBegin, objectLength;
-            cffIndexFindObject(&oldCharStringsIndex, i, &objectBegin, &objectLength);
-            cffIndexModelAppend(&newCharStringsIndex, cffObjectNodeFromFile(file, objectBegin, objectLength));
+            cffIndexModelAppend(&newCharStringsIndex, cffObjectNodeFromMemory(objectBegin, objectLength));
         }
         else
         {
-            cffIndexModelAppendEmpty(&newCharStringsIndex);
+            cffIndexModelAppendEmpty(&newCharStringsIndex, 1);
         }
     }
+    cffIndexModelAppendEmpty(&newCharStringsIndex, oldCharStringsIndex.count - nextGID);
+    shift.charStringsSizeDiff = cffIndexModelCalcSize(&newCharStringsIndex) - oldCharStringsIndexSize;
 
-    long charStringsSizeDiff = cffIndexModelCalcSize(&newCharStringsIndex) - cffIndexGetSize(&oldCharStringsIndex);
-    for (size_t i = 0; i < 4; ++i)
+    // The size of the Top DICT depends on the offsets in it, so repeat until it is stable
+    long topDictIndexSizeDiff = 0;
+    for (int resizeAttemptTimes = 0;; ++resizeAttemptTimes)
     {
-        if (!pRefOffset[i]) continue;
-        *pRefOffset[i] += nameIndexSizeDiff;
-        if (i != charStrings && *pRefOffset[i] > pRefOffset[charStrings])
+        assert(resizeAttemptTimes <= 4);
+        shift.headShift = nameIndexSizeDiff + topDictIndexSizeDiff;
+        for (size_t i = 0; i < CFF_NUM_REFS; ++i)
         {
-            *pRefOffset[i] += charStringsSizeDiff;
+            if (!pRefOffset[i]) continue;
+            *pRefOffset[i] = cffShiftOffset(&shift, oldRefOffset[i]);
         }
+        long currentTopDictSize = cffDictCalcSize(&topDict);
+        long currentTopDictIndexSize =
+                sizeof(Card16) + sizeof(OffSize) + 2 * cffCalcOffSize(currentTopDictSize + 1) + currentTopDictSize;
+        if (currentTopDictIndexSize - oldTopDictIndexSize == topDictIndexSizeDiff) break;
+        topDictIndexSizeDiff = currentTopDictIndexSize - oldTopDictIndexSize;
     }
 
-    int resizeAttemptTimes = 0;
-
-    long oldTopDictIndexOffSize = topDictIndex.offSize;
-    for (;;) // I don't know if this can really work
+    // The Font DICTs of a CID font refer to their Private DICTs by offsets too.
+    // They are rewritten into a new FDArray, which replaces the original when written.
+    const uint8_t* oldFdArray = pRefOffset[CFF_REF_FDARRAY] ? cff + fdArrayOffset : NULL;
+    CffIndexModel newFdArray;
+    cffIndexModelConstruct(&newFdArray);
+    for (size_t i = 0; oldFdArray && i < fdArray.count; ++i)
     {
-        long currentTopDictSize = cffDictCalcSize(&topDict);
-        long currentTopDictIndexOffSize = cffCalcOffSize(currentTopDictSize);
-        long offsetDiff = 
-            currentTopDictSize - oldTopDictSize + 
-            (currentTopDictIndexOffSize - oldTopDictIndexOffSize) / 2;
-        if (offsetDiff != 0)
+        const uint8_t* dictBegin;
+        long dictSize;
+        cffIndexFindObject(&fdArray, i, &dictBegin, &dictSize);
+        long newSize = cffRewriteFontDict(dictBegin, dictSize, NULL, NULL);
+        if (newSize == 0)
         {
-            for (size_t i = 0; i < 4; ++i)
-            {
-                if (pRefOffset[i]) *pRefOffset[i] += offsetDiff;
-            }
+            cffIndexModelAppendEmpty(&newFdArray, 1);
+            continue;
         }
-        else break;
-        oldTopDictSize = currentTopDictSize;
-        oldTopDictIndexOffSize = currentTopDictIndexOffSize;
-        ++resizeAttemptTimes;
-        assert(resizeAttemptTimes <= 4);
+        CffObjectNode* node = cffObjectNodeNew(newSize);
+        cffRewriteFontDict(dictBegin, dictSize, node->ext.data, &shift);
+        cffIndexModelAppend(&newFdArray, node);
     }
 
     // Finally!!!
 
-    fseek(file, fileBegin, SEEK_SET);
-    fileCopy(outFile, file, 4); // Header
-    cffIndexModelWriteToFile(&newNameIndex, outFile); // Name INDEX
+    byteSinkWrite(out, cff, header.hdrSize); // Header
+    cffIndexModelWriteToSink(&newNameIndex, out); // Name INDEX
     cffIndexModelDestruct(&newNameIndex);
 
     CffIndexModel newTopDictIndex;
     cffIndexModelConstruct(&newTopDictIndex);
     cffIndexModelAppend(&newTopDictIndex, cffObjectNodeFromDict(&topDict));
     cffDictDestruct(&topDict);
-    cffIndexModelWriteToFile(&newTopDictIndex, outFile);
+    cffIndexModelWriteToSink(&newTopDictIndex, out);
     cffIndexModelDestruct(&newTopDictIndex);
 
-    fseek(file, oldTopDictBegin + oldTopDictSize, SEEK_SET); // Region between Top DICT and CharStrings INDEX
-    fileCopy(outFile, file, oldCharStringsIndexBegin - oldTopDictSize - oldTopDictBegin);
+    // Region between Top DICT INDEX and CharStrings INDEX
+    cffWriteRegion(out, cff + regionBegin, cff + shift.oldCharStringsOffset, oldFdArray, oldFdArraySize, &newFdArray);
 
-    cffIndexModelWriteToFile(&newCharStringsIndex, outFile);
+    cffIndexModelWriteToSink(&newCharStringsIndex, out);
     cffIndexModelDestruct(&newCharStringsIndex);
 
-    long oldCharStringsIndexEnd = oldCharStringsIndexBegin + cffIndexGetSize(&oldCharStringsIndex); // Region after CharStrings INDEX
-    fseek(file, oldCharStringsIndexEnd, SEEK_SET);
-    fileCopy(outFile, file, fileBegin + length - oldCharStringsIndexEnd);
+    // Region after CharStrings INDEX
+    cffWriteRegion(out, cff + oldCharStringsIndexEnd, cff + length, oldFdArray, oldFdArraySize, &newFdArray);
+
+    cffIndexModelDestruct(&newFdArray);
+    return 1;
 }
 
-inline static void readLoca(int locaFormat, uint16_t numGlyphs, FILE* f, struct FontTableRecord* record,
-                            uint32_t* dest)
+/**
+ * 读取loca表中各字形的位置。
+ * @param loca loca表的索引
+ * @param glyfLength glyf表的长度
+ * @return loca表足够长、各位置不减小且不超出glyf表时为1
+ */
+inline static int readLoca(int locaFormat, uint16_t numGlyphs, const struct FontTableRecord* loca,
+                           uint32_t glyfLength, uint32_t* dest)
 {
-    fseek(f, record->offset, SEEK_SET);
+    if (locaFormat != 0 && locaFormat != 1) return 0;
+    if (loca->length < (numGlyphs + 1u) * (locaFormat ? 4 : 2)) return 0;
     for (int i=0; i<=numGlyphs; ++i)
     {
         if (locaFormat == 0)
-            dest[i] = readUnsignedFromFileBE(f, 2) * 2;
+            dest[i] = readUnsignedBE(loca->data + 2 * i, 2) * 2;
         else
-            dest[i] = readUnsignedFromFileBE(f, 4);
+            dest[i] = readUnsignedBE(loca->data + 4 * i, 4);
+        if ((i > 0 && dest[i] < dest[i - 1]) || dest[i] > glyfLength) return 0;
     }
+    return 1;
 }
 
-void getNewGlyfLoca(int locaFormat, size_t numGID, uint16_t numGlyphs, uint32_t fileOffset, FILE* in,
-                    uint16_t* GIDs, uint32_t* locaOld, uint32_t* locaNew, uint8_t* glyfNew)
+#define ARG_1_AND_2_ARE_WORDS       0x0001
+#define WE_HAVE_A_SCALE             0x0008
+#define MORE_COMPONENTS             0x0020
+#define WE_HAVE_AN_X_AND_Y_SCALE    0x0040
+#define WE_HAVE_A_TWO_BY_TWO        0x0080
+
+/**
+ * 把复合字形用到的部件也加入子集。部件本身也可能是复合字形。
+ * 只读取各字形在loca中的范围以内，loca须已由readLoca检查。
+ * @param keep 每个字形一字节，非0表示保留
+ */
+static void addComponents(const uint8_t* glyf, const uint32_t* loca, uint16_t numGlyphs, uint8_t* keep)
 {
-    uint8_t* pointerGlyf = glyfNew;
-    uint16_t* pointerGid = GIDs, *end = GIDs + numGID;
+    uint16_t* stack = malloc(numGlyphs * sizeof(uint16_t));
+    int top = 0;
+    for (uint16_t i = 0; i < numGlyphs; ++i)
+        if (keep[i]) stack[top++] = i;
 
-    locaNew[0] = 0;
-    for (int i=0; i<numGlyphs; ++i)
+    while (top)
     {
-        uint32_t curLength = 0;
-        if (pointerGid != end && *pointerGid == i) // 用短路逻辑运算符避免可能的段错误？
+        uint16_t gid = stack[--top];
+        if (loca[gid + 1] - loca[gid] < 10) continue; // 空字形
+        const uint8_t* p = glyf + loca[gid];
+        const uint8_t* end = glyf + loca[gid + 1];
+        if ((int16_t) readUnsignedBE(p, 2) >= 0) continue; // numberOfContours为负时是复合字形
+        p += 10; // 跳过bbox
+        uint16_t flags;
+        do
         {
-            curLength = locaOld[GIDs[i+1]] - locaOld[GIDs[i]];
-            ++pointerGid;
-            if (curLength > 0) // 即使原字体，也可能长度为0
+            if (end - p < 4) break;
+            flags = readUnsignedBE(p, 2);
+            uint16_t component = readUnsignedBE(p + 2, 2);
+            if (component < numGlyphs && !keep[component])
             {
-                fseek(in, fileOffset + locaOld[GIDs[i]], SEEK_SET); // 算出偏移量
-                fread(pointerGlyf, curLength, 1, in);
-                if (locaFormat == 0 && curLength % 2) ++curLength; // 确保偶数
-                pointerGlyf += curLength;
+                keep[component] = 1;
+                stack[top++] = component;
             }
-        }
-        locaNew[i+1] = locaOld[i] + curLength;
+            p += 4 + ((flags & ARG_1_AND_2_ARE_WORDS) ? 4 : 2);
+            if (flags & WE_HAVE_A_SCALE) p += 2;
+            else if (flags & WE_HAVE_AN_X_AND_Y_SCALE) p += 4;
+            else if (flags & WE_HAVE_A_TWO_BY_TWO) p += 8;
+        } while (flags & MORE_COMPONENTS);
     }
+    free(stack);
 }
 
-inline static uint32_t calculateChecksum(int length, const uint8_t* data)
+inline static void storeUnsignedBE(uint8_t* p, uint32_t val, size_t size)
 {
-    uint32_t checkSums[4] = {0,0,0,0};
-    for (int i=0; i<length; ++i)
-        checkSums[i%4] += (uint8_t) data[i];
-    return (checkSums[0] << 24u) + (checkSums[1] << 16u) + (checkSums[2] << 8u) + checkSums[3];
+    for (size_t i = 0; i < size; ++i)
+        p[i] = val >> (8 * (size - 1 - i));
+}
+
+// 按大端序的32位整数求和，不足4字节的部分补0
+inline static uint32_t calculateChecksum(uint32_t length, const uint8_t* data)
+{
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < length; i += 4)
+    {
+        uint32_t word = 0;
+        for (uint32_t j = i; j < i + 4; ++j)
+            word = (word << 8) + (j < length ? data[j] : 0);
+        sum += word;
+    }
+    return sum;
 }
 
 #define NEXT_MULT_OF_4(x) (((x)+3)&~3)
-#define GLYF 1
-#define HEAD 2
-#define LOCA 5
-#define MAXP 6
+
+/**
+ * 生成SFNT字体的文件头及表索引。各表的offset按顺序重新计算，每个表对齐到4字节。
+ * @param records 各表索引，须按tag排序
+ * @param numTables 表的个数
+ * @param output 输出地址，须有12+16×numTables字节
+ */
+static void buildTableDirectory(struct FontTableRecord* records, uint16_t numTables, uint8_t* output)
+{
+    uint16_t entrySelector = 0;
+    while ((2u << entrySelector) <= numTables) ++entrySelector;
+    uint16_t searchRange = 16u << entrySelector;
+
+    storeUnsignedBE(output, 0x00010000, 4);
+    storeUnsignedBE(output + 4, numTables, 2);
+    storeUnsignedBE(output + 6, searchRange, 2);
+    storeUnsignedBE(output + 8, entrySelector, 2);
+    storeUnsignedBE(output + 10, numTables * 16 - searchRange, 2);
+
+    uint32_t offset = 12 + numTables * 16;
+    for (uint16_t i = 0; i < numTables; ++i)
+    {
+        records[i].offset = offset;
+        offset += NEXT_MULT_OF_4(records[i].length);
+        uint8_t* p = output + 12 + i * 16;
+        storeUnsignedBE(p, records[i].tableTag, 4);
+        storeUnsignedBE(p + 4, records[i].checkSum, 4);
+        storeUnsignedBE(p + 8, records[i].offset, 4);
+        storeUnsignedBE(p + 12, records[i].length, 4);
+    }
+}
+
+// 嵌入PDF的TrueType字体需要的表（存在时才输出），按tag排序
+#define NUM_SUBSET_TABLES 12
+static const char subsetTags[NUM_SUBSET_TABLES][5] = {
+        "cmap", "cvt ", "fpgm", "glyf", "head", "hhea", "hmtx", "loca", "maxp", "name", "post", "prep"
+};
 
 /**
  * 生成一个SFNT字体的子集。
+ * 未用到的字形在loca表中长度为0，使GID不变；复合字形的部件会自动加入子集。
  * @param numGID 一共使用的GID数
  * @param GIDs GID列表，以升序排列。
  * @param f 原字体。
+ * @param out 输出到的缓冲层
+ * @return 成功时为1，缺少glyf、head或loca表，或它们不完整时为0
  */
-void outputSubsetSFNT(size_t numGID, uint16_t* GIDs, Font* f)
+int outputSubsetSFNT(size_t numGID, uint16_t* GIDs, Font* f, ByteSink* out)
 {
-    // Truetype字体必需的表有9个：cmap、glyf、head、hhea、hmtx、loca、maxp、name、post。
-    unsigned char header[12] = {0,1,0,0, 0,9,      0,128,      0,3,          0,16};
-    //                          TTF      numTables searchRange entrySelector rangeShift
-    char requiredTag[9][5] = {"cmap", "glyf", "head", "hhea", "hmtx", "loca", "maxp", "name", "post"};
-    struct FontTableRecord newRecord[9];
-    int oldOffset[9];
-    for (int i=0; i<9; ++i)
+    struct FontTableRecord newRecord[NUM_SUBSET_TABLES];
+    uint8_t* newData[NUM_SUBSET_TABLES] = {0}; // 重新生成的表，其他表从原字体复制
+    int numTables = 0, glyf = -1, head = -1, loca = -1;
+    for (int i=0; i<NUM_SUBSET_TABLES; ++i)
     {
-        int origIndex = findIndexOfTable(f, requiredTag[i]);
-        newRecord[i] = f->tableRecords[origIndex];
-        oldOffset[i] = newRecord[i].offset;
+        uint16_t origIndex = findIndexOfTable(f, subsetTags[i]);
+        const char* t = subsetTags[i];
+        if (origIndex == f->numTables) continue;
+        if (!strcmp(t, "glyf")) glyf = numTables;
+        else if (!strcmp(t, "head")) head = numTables;
+        else if (!strcmp(t, "loca")) loca = numTables;
+        newRecord[numTables] = f->tableRecords[origIndex];
+        ++numTables;
     }
+    if (glyf < 0 || head < 0 || loca < 0 || newRecord[head].length < 54) return 0;
 
     // 读取loca表样式及字符数
-    fseek(f->fontFile, oldOffset[HEAD] + 50, SEEK_SET);
-    int locaFormat = fgetc(f->fontFile);
-    fseek(f->fontFile, oldOffset[MAXP] + 4, SEEK_SET);
-    uint16_t numGlyphs = readUnsignedFromFileBE(f->fontFile, 2);
-    uint32_t* locaOld = malloc((numGlyphs + 1) * sizeof(int));
-    uint32_t* locaNew = malloc((numGlyphs + 1) * sizeof(int));
-
-    // 读取旧的loca表
-    readLoca(locaFormat, numGlyphs, f->fontFile, newRecord + LOCA, locaOld);
-
-    // 计算偏移量
-    int shortOffset = 0;
-    int longOffset = 0;
-    for (int i=0; i<numGID; ++i)
+    int locaFormat = (int16_t) readUnsignedBE(newRecord[head].data + 50, 2);
+    uint16_t numGlyphs = f->numGlyphs;
+    uint32_t* locaOld = malloc((numGlyphs + 1) * sizeof(uint32_t));
+    if (!readLoca(locaFormat, numGlyphs, newRecord + loca, newRecord[glyf].length, locaOld))
+    {
+        free(locaOld);
+        return 0;
+    }
+    uint32_t* locaNew = malloc((numGlyphs + 1) * sizeof(uint32_t));
+
+    // 确定要保留的字形
+    uint8_t* keep = calloc(numGlyphs, 1);
+    for (size_t i = 0; i < numGID; ++i)
+        if (GIDs[i] < numGlyphs) keep[GIDs[i]] = 1;
+    addComponents(newRecord[glyf].data, locaOld, numGlyphs, keep);
+
+    // 生成新的glyf和loca表，每个字形补齐到偶数字节
+    locaNew[0] = 0;
+    for (uint16_t i = 0; i < numGlyphs; ++i)
     {
-        uint32_t curLength = locaOld[GIDs[i+1]] - locaOld[GIDs[i]];
-        longOffset += curLength;
-        shortOffset += curLength;
-        if (curLength % 2 == 1)
-            shortOffset += 1;
+        uint32_t curLength = keep[i] ? locaOld[i + 1] - locaOld[i] : 0;
+        locaNew[i + 1] = locaNew[i] + curLength + curLength % 2;
     }
-    locaFormat = shortOffset > 131072; // 短式偏移量最大能表示的是65536WORD，即131072B
-
-    // 生成新的glyph和loca表
-    uint8_t* glyfNew = calloc(newRecord[GLYF].length, 1); // 默认为0
-    getNewGlyfLoca(locaFormat, numGID, numGlyphs, oldOffset[GLYF],
-                   f->fontFile, GIDs, locaOld, locaNew, glyfNew);
-    newRecord[GLYF].length = locaNew[numGlyphs]; // 新glyf表的长度等于locaNew的最后一项
-
-    // loca表
-    newRecord[LOCA].length = (numGlyphs + 1) * (locaFormat ? 4 : 2);
-    uint8_t* locaData = calloc(NEXT_MULT_OF_4(newRecord[LOCA].length), 1);
-    if (locaFormat) // 长版
+    newRecord[glyf].length = locaNew[numGlyphs];
+    uint8_t* glyfNew = newData[glyf] = calloc(NEXT_MULT_OF_4(newRecord[glyf].length) + 4, 1);
+    for (uint16_t i = 0; i < numGlyphs; ++i)
+        if (locaNew[i + 1] != locaNew[i])
+            memcpy(glyfNew + locaNew[i], newRecord[glyf].data + locaOld[i], locaOld[i + 1] - locaOld[i]);
+    locaFormat = locaNew[numGlyphs] > 0x1FFFE; // 短式偏移量最大能表示的是65535WORD
+
+    newRecord[loca].length = (numGlyphs + 1) * (locaFormat ? 4 : 2);
+    uint8_t* locaData = newData[loca] = calloc(NEXT_MULT_OF_4(newRecord[loca].length), 1);
+    for (int i=0; i<=numGlyphs; ++i)
     {
-        for (int i=0; i<=numGlyphs; ++i)
-            switchEndian32(locaNew + i);
-        memcpy(locaData, locaNew, 4 * (numGlyphs + 1));
+        if (locaFormat) storeUnsignedBE(locaData + 4 * i, locaNew[i], 4);
+        else storeUnsignedBE(locaData + 2 * i, locaNew[i] / 2, 2);
     }
-    else for (int i=0; i<=numGlyphs; ++i) // 短版
-        {
-            locaData[2*i] = locaNew[2*i] >> 9u;
-            locaData[2*i+1] = locaNew[2*i] >> 1u;
-        }
-
-    // 调整offset
-    newRecord[0].offset = 156; // 12+9×16
-    for (int i=1; i<9; ++i)
-        newRecord[i].offset = newRecord[i-1].offset + NEXT_MULT_OF_4(newRecord[i-1].length);
 
-    // 计算checksum和head表里的checksumAdjustment
-    newRecord[GLYF].checkSum = calculateChecksum(newRecord[GLYF].length, glyfNew);
-    newRecord[LOCA].checkSum = calculateChecksum(newRecord[LOCA].length, locaData);
-    uint32_t checkSum = 0x000D0090; // 前12字节的checkSum
-    for (int i=0; i<9; ++i) // 索引及各表
+    // head表：更新loca样式，先把checksum adjustment置0
+    uint8_t* headTable = newData[head] = calloc(NEXT_MULT_OF_4(newRecord[head].length), 1);
+    memcpy(headTable, newRecord[head].data, newRecord[head].length);
+    storeUnsignedBE(headTable + 8, 0, 4);
+    storeUnsignedBE(headTable + 50, locaFormat, 2);
+
+    newRecord[glyf].checkSum = calculateChecksum(newRecord[glyf].length, glyfNew);
+    newRecord[loca].checkSum = calculateChecksum(newRecord[loca].length, locaData);
+    newRecord[head].checkSum = calculateChecksum(newRecord[head].length, headTable);
+
+    // 计算offset及整个文件的checksum
+    uint32_t directorySize = 12 + numTables * 16;
+    uint8_t* directory = malloc(directorySize);
+    buildTableDirectory(newRecord, numTables, directory);
+    uint32_t checkSum = calculateChecksum(directorySize, directory);
+    for (int i=0; i<numTables; ++i)
         checkSum += newRecord[i].checkSum;
-    for (uint32_t* p = (uint32_t*) newRecord; p < (uint32_t*) newRecord + 9; ++p)
-        checkSum += *p;
-
-    // head表
-    char* headTable = malloc(NEXT_MULT_OF_4(newRecord[HEAD].length));
-    fseek(f->fontFile, oldOffset[HEAD], SEEK_SET);
-    fread(headTable, NEXT_MULT_OF_4(newRecord[HEAD].length), 1, f->fontFile);
-    *(uint32_t*) (headTable + 8) = 0xB1B0AFBA - checkSum; // 先把checksum adjustment置0
+    storeUnsignedBE(headTable + 8, 0xB1B0AFBA - checkSum, 4);
 
     // 输出
-    fwrite(header, 1, 12, outFile);
-    for (uint32_t* p = (uint32_t*) newRecord; p < (uint32_t*) newRecord + 9; ++p)
-        writeUnsignedToFileBE(outFile, *p, 4);
-    for (int i=0; i<9; ++i)
+    byteSinkWrite(out, directory, directorySize);
+    for (int i=0; i<numTables; ++i)
     {
-        if (i == GLYF) fwrite(glyfNew, 1, NEXT_MULT_OF_4(newRecord[GLYF].length), outFile);
-        else if (i == LOCA) fwrite(locaData, 1, NEXT_MULT_OF_4(newRecord[LOCA].length), outFile);
-        else if (i == HEAD) fwrite(headTable, 1, NEXT_MULT_OF_4(newRecord[HEAD].length), outFile);
-        else
+        uint32_t paddedLength = NEXT_MULT_OF_4(newRecord[i].length);
+        if (newData[i])
         {
-            char* tmp = calloc(NEXT_MULT_OF_4(newRecord[i].length), 1);
-            fseek(f->fontFile, oldOffset[i], SEEK_SET);
-            fread(tmp, 1, newRecord[i].length, f->fontFile);
-            fwrite(tmp, 1, NEXT_MULT_OF_4(newRecord[i].length), outFile);
-            free(tmp);
+            byteSinkWrite(out, newData[i], paddedLength);
+            continue;
         }
+        byteSinkWrite(out, newRecord[i].data, newRecord[i].length);
+        byteSinkPadZero(out, paddedLength - newRecord[i].length);
     }
 
     // 析构
+    free(directory);
+    free(keep);
     free(locaOld);
     free(locaNew);
     free(locaData);
     free(glyfNew);
     free(headTable);
-}
\ No newline at end of file
+    return 1;
+}
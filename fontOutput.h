@@ -5,10 +5,12 @@
 #ifndef JDVPDF_FONTWRITER_H
 #define JDVPDF_FONTWRITER_H
 
-#include "stdint.h"
+#include <stdint.h>
+
 #include "fontObject.h"
+#include "byteSink.h"
 
-void outputSubsetCFF(size_t, uint16_t*, Font*);
-void outputSubsetSFNT(size_t, uint16_t*, Font*);
+int outputSubsetCFF(size_t, uint16_t*, Font*, ByteSink*);
+int outputSubsetSFNT(size_t, uint16_t*, Font*, ByteSink*);
 
 #endif //JDVPDF_FONTWRITER_H
@@ -0,0 +1,333 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jdvCursor.h"
+
+/**
+ * 把JDV文件整个映射到内存。无法映射时（如管道）退回到一次性读入。
+ * @param file 输出到的地址
+ * @param fileName 文件名
+ * @return 成功时为1
+ */
+int jdvFileOpen(JdvFile* file, const char* fileName)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = 0;
+    file->borrowed = 0;
+
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            file->data = p;
+            file->size = st.st_size;
+            file->mapped = 1;
+            close(fd);
+            return 1;
+        }
+    }
+
+    // 退回到read
+    size_t capacity = 65536;
+    uint8_t* buffer = malloc(capacity);
+    ssize_t got;
+    while ((got = read(fd, buffer + file->size, capacity - file->size)) > 0)
+    {
+        file->size += got;
+        if (file->size == capacity)
+        {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    close(fd);
+    if (got < 0)
+    {
+        free(buffer);
+        file->size = 0;
+        return 0;
+    }
+    file->data = buffer;
+    return 1;
+}
+
+/**
+ * 直接使用调用者内存中的JDV文件，不复制。关闭时不释放，调用者须保证其在转换期间有效。
+ */
+void jdvFileFromMemory(JdvFile* file, const void* data, size_t size)
+{
+    file->data = data;
+    file->size = size;
+    file->mapped = 0;
+    file->borrowed = 1;
+}
+
+void jdvFileClose(JdvFile* file)
+{
+    if (!file->data) return;
+    if (!file->borrowed)
+    {
+        if (file->mapped) munmap((void*) file->data, file->size);
+        else free((void*) file->data);
+    }
+    file->data = NULL;
+    file->size = 0;
+}
+
+/**
+ * 开始从文件描述符逐步读入JDV文件，此时还没有读入任何内容。
+ * @param file 存放已读入内容的位置
+ * @param fd 文件描述符，如标准输入
+ */
+void jdvStreamOpen(JdvStream* s, JdvFile* file, int fd)
+{
+    s->file = file;
+    s->capacity = 65536;
+    s->fd = fd;
+    file->data = malloc(s->capacity);
+    file->size = 0;
+    file->mapped = 0;
+    file->borrowed = 0;
+}
+
+/**
+ * 再读入一些内容，追加到已有内容之后。缓冲区满时扩大一倍。
+ * @return 读入的字节数，到达文件尾或出错时为0
+ */
+size_t jdvStreamRead(JdvStream* s)
+{
+    JdvFile* file = s->file;
+    if (file->size == s->capacity)
+    {
+        s->capacity *= 2;
+        file->data = realloc((void*) file->data, s->capacity);
+    }
+    ssize_t got;
+    do got = read(s->fd, (uint8_t*) file->data + file->size, s->capacity - file->size);
+    while (got < 0 && errno == EINTR);
+    if (got <= 0) return 0;
+    file->size += got;
+    return got;
+}
+
+/**
+ * 丢弃开头已经用完的n个字节，其后的内容移到开头。
+ */
+void jdvStreamDiscard(JdvStream* s, size_t n)
+{
+    JdvFile* file = s->file;
+    if (n == 0) return;
+    memmove((void*) file->data, file->data + n, file->size - n);
+    file->size -= n;
+}
+
+/**
+ * 读完剩余的输入（以免写入的一方因管道被关闭而出错），然后释放缓冲区。
+ */
+void jdvStreamClose(JdvStream* s)
+{
+    do s->file->size = 0;
+    while (jdvStreamRead(s));
+    jdvFileClose(s->file);
+}
+
+void jdvCursorInit(JdvCursor* c, const JdvFile* file)
+{
+    c->begin = file->data;
+    c->pos = file->data;
+    c->end = file->data + file->size;
+}
+
+/**
+ * 移动到文件中的绝对位置。
+ * @return 位置合法时为1
+ */
+int jdvCursorSeek(JdvCursor* c, size_t offset)
+{
+    if (offset > (size_t) (c->end - c->begin)) return 0;
+    c->pos = c->begin + offset;
+    return 1;
+}
+
+// 读取一个长度为size的参数
+inline static int readOperand(JdvCursor* c, JdvCommand* cmd, int type, int size, _Bool isSigned)
+{
+    if (!jdvCursorHas(c, size)) return 0;
+    cmd->type = type;
+    cmd->a = isSigned ? jdvReadSigned(c, size) : (int32_t) jdvReadUnsigned(c, size);
+    return 1;
+}
+
+inline static int readCommand(JdvCursor* c, JdvCommand* cmd, int op)
+{
+    if (op < SET1) // 0～127号，输出字符
+    {
+        cmd->type = JDV_CMD_SET_CHAR;
+        cmd->a = op;
+        return 1;
+    }
+    if (op < SET_RULE) // 128～131号，127以后的字符
+        return readOperand(c, cmd, JDV_CMD_SET_CHAR, op - SET1 + 1, 0);
+    if (op == SET_RULE || op == PUT_RULE)
+    {
+        if (!jdvCursorHas(c, 8)) return 0;
+        cmd->type = op == SET_RULE ? JDV_CMD_SET_RULE : JDV_CMD_PUT_RULE;
+        cmd->a = jdvReadSigned(c, 4);
+        cmd->b = jdvReadSigned(c, 4);
+        return 1;
+    }
+    if (op < PUT_RULE) // 133～136号
+        return readOperand(c, cmd, JDV_CMD_PUT_CHAR, op - PUT1 + 1, 0);
+    if (op < W0)
+    {
+        switch (op)
+        {
+            case NOP:
+                cmd->type = JDV_CMD_NOP;
+                return 1;
+            case BOP: // c0～c9及指向上一页的指针
+                if (!jdvCursorHas(c, 44)) return 0;
+                cmd->type = JDV_CMD_BOP;
+                cmd->a = jdvReadSigned(c, 4);
+                c->pos += 36;
+                cmd->b = jdvReadSigned(c, 4);
+                return 1;
+            case EOP:
+                cmd->type = JDV_CMD_EOP;
+                return 1;
+            case PUSH:
+                cmd->type = JDV_CMD_PUSH;
+                return 1;
+            case POP:
+                cmd->type = JDV_CMD_POP;
+                return 1;
+            default: // 143～146号，right
+                return readOperand(c, cmd, JDV_CMD_RIGHT, op - RIGHT1 + 1, 1);
+        }
+    }
+    if (op < FNT_NUM_0) // w、x、down、y、z及其变体
+    {
+        static const uint8_t types[24] = {
+                JDV_CMD_W, JDV_CMD_W, JDV_CMD_W, JDV_CMD_W, JDV_CMD_W,
+                JDV_CMD_X, JDV_CMD_X, JDV_CMD_X, JDV_CMD_X, JDV_CMD_X,
+                JDV_CMD_DOWN, JDV_CMD_DOWN, JDV_CMD_DOWN, JDV_CMD_DOWN,
+                JDV_CMD_Y, JDV_CMD_Y, JDV_CMD_Y, JDV_CMD_Y, JDV_CMD_Y,
+                JDV_CMD_Z, JDV_CMD_Z, JDV_CMD_Z, JDV_CMD_Z, JDV_CMD_Z
+        };
+        static const uint8_t sizes[24] = {
+                0, 1, 2, 3, 4,
+                0, 1, 2, 3, 4,
+                1, 2, 3, 4,
+                0, 1, 2, 3, 4,
+                0, 1, 2, 3, 4
+        };
+        int size = sizes[op - W0];
+        cmd->type = types[op - W0];
+        if (size == 0) return 1;
+        cmd->b = 1;
+        return readOperand(c, cmd, types[op - W0], size, 1);
+    }
+    if (op < FNT1) // 171～234号，fnt_num
+    {
+        cmd->type = JDV_CMD_FNT;
+        cmd->a = op - FNT_NUM_0;
+        return 1;
+    }
+    if (op < XXX1)
+        return readOperand(c, cmd, JDV_CMD_FNT, op - FNT1 + 1, op == FNT1 + 3);
+    if (op < FONT_DEF1) // 239～242；注释、special
+    {
+        if (!readOperand(c, cmd, JDV_CMD_XXX, op - XXX1 + 1, 0)) return 0;
+        if (!jdvCursorHas(c, (uint32_t) cmd->a)) return 0;
+        cmd->data = c->pos;
+        cmd->length = cmd->a;
+        c->pos += cmd->length;
+        return 1;
+    }
+    if (op < PRE) // 字体定义
+    {
+        int size = op - FONT_DEF1 + 1;
+        if (!jdvCursorHas(c, size + 14)) return 0;
+        cmd->type = JDV_CMD_FONT_DEF;
+        cmd->a = size == 4 ? jdvReadSigned(c, 4) : (int32_t) jdvReadUnsigned(c, size);
+        c->pos += 4; // 不再用checksum
+        cmd->b = jdvReadSigned(c, 4);
+        c->pos += 4; // 不再用TFM中的size
+        cmd->length = c->pos[0] + c->pos[1]; // 整个目录的长度
+        c->pos += 2;
+        if (!jdvCursorHas(c, cmd->length)) return 0;
+        cmd->data = c->pos;
+        c->pos += cmd->length;
+        return 1;
+    }
+    switch (op)
+    {
+        case PRE:
+            if (!jdvCursorHas(c, 14)) return 0;
+            cmd->type = JDV_CMD_PRE;
+            c->pos += 1; // i
+            cmd->a = jdvReadSigned(c, 4);
+            cmd->b = jdvReadSigned(c, 4);
+            cmd->length = jdvReadUnsigned(c, 4);
+            int k = *c->pos++;
+            if (!jdvCursorHas(c, k)) return 0;
+            cmd->data = c->pos;
+            c->pos += k;
+            return 1;
+        case POST:
+            if (!jdvCursorHas(c, 28)) return 0;
+            cmd->type = JDV_CMD_POST;
+            cmd->a = jdvReadSigned(c, 4);
+            c->pos += 22; // num、den、mag、l、u、s
+            cmd->b = (int32_t) jdvReadUnsigned(c, 2);
+            return 1;
+        case POST_POST:
+            if (!jdvCursorHas(c, 5)) return 0;
+            cmd->type = JDV_CMD_POST_POST;
+            cmd->a = jdvReadSigned(c, 4);
+            c->pos += 1;
+            return 1;
+        default: // 250～255号未定义
+            return 0;
+    }
+}
+
+/**
+ * 解码当前位置的一条命令，并移动到下一条命令。
+ * 出错（文件被截断或遇到未定义的命令）时cmd->type为JDV_CMD_ERROR，位置不变。
+ * @return 成功时为1
+ */
+int jdvNextCommand(JdvCursor* c, JdvCommand* cmd)
+{
+    const uint8_t* start = c->pos;
+    cmd->type = JDV_CMD_ERROR;
+    cmd->b = 0;
+    cmd->data = NULL;
+    cmd->length = 0;
+    if (!jdvCursorHas(c, 1)) return 0;
+
+    cmd->opcode = *c->pos++;
+    if (readCommand(c, cmd, cmd->opcode)) return 1;
+
+    cmd->type = JDV_CMD_ERROR;
+    c->pos = start;
+    return 0;
+}
@@ -0,0 +1,158 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_JDVCURSOR_H
+#define JDVPDF_JDVCURSOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// JDV命令字节（与DVI相同）
+#define SET_CHAR_0  0
+#define SET1        128
+#define SET_RULE    132
+#define PUT1        133
+#define PUT_RULE    137
+#define NOP         138
+#define BOP         139
+#define EOP         140
+#define PUSH        141
+#define POP         142
+#define RIGHT1      143
+#define W0          147
+#define W1          148
+#define X0          152
+#define X1          153
+#define DOWN1       157
+#define Y0          161
+#define Y1          162
+#define Z0          166
+#define Z1          167
+#define FNT_NUM_0   171
+#define FNT1        235
+#define XXX1        239
+#define FONT_DEF1   243
+#define PRE         247
+#define POST        248
+#define POST_POST   249
+
+// 解码后的命令类型
+#define JDV_CMD_SET_CHAR    0
+#define JDV_CMD_PUT_CHAR    1
+#define JDV_CMD_SET_RULE    2
+#define JDV_CMD_PUT_RULE    3
+#define JDV_CMD_NOP         4
+#define JDV_CMD_BOP         5
+#define JDV_CMD_EOP         6
+#define JDV_CMD_PUSH        7
+#define JDV_CMD_POP         8
+#define JDV_CMD_RIGHT       9
+#define JDV_CMD_W           10
+#define JDV_CMD_X           11
+#define JDV_CMD_DOWN        12
+#define JDV_CMD_Y           13
+#define JDV_CMD_Z           14
+#define JDV_CMD_FNT         15
+#define JDV_CMD_XXX         16
+#define JDV_CMD_FONT_DEF    17
+#define JDV_CMD_PRE         18
+#define JDV_CMD_POST        19
+#define JDV_CMD_POST_POST   20
+#define JDV_CMD_ERROR       21
+
+// 映射到内存中的JDV文件
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    _Bool mapped; // 为0时data由malloc分配
+    _Bool borrowed; // 为1时data属于调用者，关闭时不释放
+} JdvFile;
+
+/*
+ * 从管道等不能回退的来源逐步读入的JDV文件。已读入且未丢弃的部分放在file中（mapped为0），
+ * file->data可能因读入而移动，因此只能用相对位置记录其中的命令。
+ */
+typedef struct {
+    JdvFile* file;
+    size_t capacity;
+    int fd;
+} JdvStream;
+
+// 带边界检查的读取位置
+typedef struct {
+    const uint8_t* begin;
+    const uint8_t* pos;
+    const uint8_t* end;
+} JdvCursor;
+
+/*
+ * 一条解码后的命令。各参数的意义随命令而定：
+ *     SET_CHAR/PUT_CHAR：a为字符（GID）
+ *     SET_RULE/PUT_RULE：a为高度，b为宽度
+ *     BOP：a为c0（页码），b为上一个BOP的位置
+ *     RIGHT/DOWN：a为距离
+ *     W/X/Y/Z：b为1时a为新的距离，b为0时表示w0、x0等
+ *     FNT：a为字体号
+ *     XXX：data、length为special的内容
+ *     FONT_DEF：a为字体号，b为字体大小，data、length为字体路径
+ *     PRE：a为num，b为den，length为mag，data为注释
+ *     POST：a为最后一个BOP的位置，b为总页数t
+ *     POST_POST：a为postamble的位置
+ * data始终指向映射中的位置，不另外复制。
+ */
+typedef struct {
+    uint8_t opcode;
+    uint8_t type;
+    int32_t a;
+    int32_t b;
+    const uint8_t* data;
+    uint32_t length;
+} JdvCommand;
+
+int jdvFileOpen(JdvFile*, const char*);
+void jdvFileFromMemory(JdvFile*, const void*, size_t);
+void jdvFileClose(JdvFile*);
+
+void jdvStreamOpen(JdvStream*, JdvFile*, int);
+size_t jdvStreamRead(JdvStream*);
+void jdvStreamDiscard(JdvStream*, size_t);
+void jdvStreamClose(JdvStream*);
+
+void jdvCursorInit(JdvCursor*, const JdvFile*);
+int jdvCursorSeek(JdvCursor*, size_t);
+
+int jdvNextCommand(JdvCursor*, JdvCommand*);
+
+inline static size_t jdvCursorOffset(const JdvCursor* c)
+{
+    return c->pos - c->begin;
+}
+
+inline static _Bool jdvCursorHas(const JdvCursor* c, size_t n)
+{
+    return (size_t) (c->end - c->pos) >= n;
+}
+
+/**
+ * 按大端序读取无符号整数。调用前必须用jdvCursorHas确认长度。
+ * @param size 字节数（1～4）
+ */
+inline static uint32_t jdvReadUnsigned(JdvCursor* c, int size)
+{
+    uint32_t result = 0;
+    for (int i=0; i<size; ++i)
+        result = (result << 8) + *c->pos++;
+    return result;
+}
+
+// 同上，但按补码解释为有符号整数
+inline static int32_t jdvReadSigned(JdvCursor* c, int size)
+{
+    uint32_t result = jdvReadUnsigned(c, size);
+    if (size < 4 && (result >> (size * 8 - 1)))
+        result |= UINT32_MAX << (size * 8);
+    return (int32_t) result;
+}
+
+#endif //JDVPDF_JDVCURSOR_H
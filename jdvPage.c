@@ -0,0 +1,339 @@
+//
+// Created by david on 2026/10/17.
+//
+
+/*
+ * 解释一页JDV命令，生成PDF内容流。
+ * h向右、v向下，以纸张左上角为原点；输出时换算为以左下角为原点、以bp为单位的PDF坐标。
+ * 与DVI相同，每页在BOP处h、v、w、x、y、z均为0，栈为空，且未选定字体，
+ * 因此解释一页只需要这一页自己的状态，各页也可以在不同线程中同时解释。
+ *
+ * 同一基线上连续的字形合并为一个TJ数组，字形间与阅读器按/W推算的位置不同时插入字距调整。
+ * 字体和文字矩阵只在改变时输出Tf、Tm。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "byteBuffer.h"
+#include "fontObject.h"
+#include "jdvCursor.h"
+#include "jdvReader.h"
+#include "jdvPage.h"
+
+
+struct Registers {
+    int32_t h, v, w, x, y, z;
+};
+
+typedef struct {
+    const Conversion* conversion; // 该页所属的转换，解释时只读
+    int page; // 该页的序号（从0开始），用于报错
+    ByteBuffer* out;
+    struct Registers reg;
+    struct Registers* stack;
+    int stackTop;
+    int stackSize;
+    struct FontTable* font; // 当前字体，NULL表示尚未选定
+    _Bool inText; // 是否在BT和ET之间
+    struct FontTable* textFont; // 已用Tf选定的字体，NULL表示未知
+    double fontSize; // textFont的大小（bp）
+    _Bool penKnown; // 是否已用Tm设置过当前BT中的位置
+    int32_t runV; // 当前文字的基线
+    double penX; // 阅读器按/W推算的当前文字位置（bp）
+    _Bool inArray; // 是否在TJ的数组中
+    _Bool inString; // 是否在数组中的<>之间
+} PageState;
+
+inline static double pdfX(const PageState* s, int32_t h)
+{
+    return h * s->conversion->jdvScale;
+}
+
+inline static double pdfY(const PageState* s, int32_t v)
+{
+    return s->conversion->paperHeight - v * s->conversion->jdvScale;
+}
+
+// 结束当前的TJ数组
+inline static void endRun(PageState* s)
+{
+    if (!s->inArray) return;
+    if (s->inString) byteBufferPutc(s->out, '>');
+    byteBufferPuts(s->out, "] TJ\n");
+    s->inArray = 0;
+    s->inString = 0;
+}
+
+inline static void endText(PageState* s)
+{
+    if (!s->inText) return;
+    endRun(s);
+    byteBufferPuts(s->out, "ET\n");
+    s->inText = 0;
+}
+
+/**
+ * 在字体的字形集合中记录用到的字形。各页可能在不同线程中同时解释，因此用原子操作。
+ * @param gid 不超过0xFFFF，由drawChar检查
+ */
+inline static void markGlyph(struct FontTable* t, uint32_t gid)
+{
+    uint64_t* word = t->usedGlyphs + gid / 64;
+    uint64_t bit = (uint64_t) 1 << (gid % 64);
+    if (!(__atomic_load_n(word, __ATOMIC_RELAXED) & bit))
+        __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+}
+
+// 每个字节对应的两个十六进制数字
+static const char hexPairs[] =
+        "000102030405060708090A0B0C0D0E0F"
+        "101112131415161718191A1B1C1D1E1F"
+        "202122232425262728292A2B2C2D2E2F"
+        "303132333435363738393A3B3C3D3E3F"
+        "404142434445464748494A4B4C4D4E4F"
+        "505152535455565758595A5B5C5D5E5F"
+        "606162636465666768696A6B6C6D6E6F"
+        "707172737475767778797A7B7C7D7E7F"
+        "808182838485868788898A8B8C8D8E8F"
+        "909192939495969798999A9B9C9D9E9F"
+        "A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+        "B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+        "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+        "D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+        "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+        "F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+// 按Identity-H把GID写成4个十六进制数字
+inline static void putGlyphHex(ByteBuffer* b, uint32_t gid)
+{
+    if (b->size + 4 > b->capacity) byteBufferReserve(b, b->size + 4);
+    memcpy(b->data + b->size, hexPairs + (gid >> 8 & 0xFF) * 2, 2);
+    memcpy(b->data + b->size + 2, hexPairs + (gid & 0xFF) * 2, 2);
+    b->size += 4;
+}
+
+/**
+ * 输出一个字形，返回其宽度（JDV单位）。
+ * @return 字体未选定或GID超出Identity-H的范围时为-1
+ */
+static int32_t drawChar(PageState* s, uint32_t gid)
+{
+    struct FontTable* t = s->font;
+    if (!t) return -1;
+    if (gid > 0xFFFF)
+    {
+        fprintf(stderr, "第%d页的字形号%u超出范围。", s->page + 1, gid);
+        return -1;
+    }
+    if (!s->inText)
+    {
+        byteBufferPuts(s->out, "BT\n");
+        s->inText = 1;
+        s->penKnown = 0;
+    }
+    if (s->textFont != t)
+    {
+        endRun(s);
+        s->fontSize = t->size * s->conversion->jdvScale;
+        byteBufferPrintf(s->out, "/F%d %.3f Tf\n", t->number, s->fontSize);
+        s->textFont = t;
+    }
+
+    double x = pdfX(s, s->reg.h);
+    int adjust = 0; // TJ中的字距调整，以1/1000字号为单位，正数向左
+    if (s->penKnown && s->reg.v == s->runV && s->fontSize > 0)
+    {
+        double d = (s->penX - x) * 1000 / s->fontSize;
+        adjust = (int) (d < 0 ? d - 0.5 : d + 0.5);
+    }
+    else
+    {
+        endRun(s);
+        byteBufferPrintf(s->out, "1 0 0 1 %.3f %.3f Tm\n", x, pdfY(s, s->reg.v));
+        s->penKnown = 1;
+        s->runV = s->reg.v;
+        s->penX = x;
+    }
+
+    if (!s->inArray)
+    {
+        byteBufferPutc(s->out, '[');
+        s->inArray = 1;
+    }
+    if (adjust)
+    {
+        if (s->inString) byteBufferPutc(s->out, '>');
+        byteBufferPrintf(s->out, "%d", adjust);
+        s->inString = 0;
+        s->penX -= adjust * s->fontSize / 1000;
+    }
+    if (!s->inString)
+    {
+        byteBufferPutc(s->out, '<');
+        s->inString = 1;
+    }
+    putGlyphHex(s->out, gid);
+    Font* f = fontTableFont(t); // 选定时已载入；其他页的线程可能同时写入，故不直接读t->font
+    s->penX += fontGlyphWidthPdf(f, gid) * s->fontSize / 1000;
+    markGlyph(t, gid);
+    return (int64_t) fontGlyphAdvance(f, gid) * t->size / f->unitsPerEm;
+}
+
+// 规则（实心矩形），(h, v)为左下角
+static void drawRule(PageState* s, int32_t height, int32_t width)
+{
+    if (height <= 0 || width <= 0) return;
+    endText(s);
+    byteBufferPrintf(s->out, "%.3f %.3f %.3f %.3f re f\n",
+            pdfX(s, s->reg.h), pdfY(s, s->reg.v), width * s->conversion->jdvScale, height * s->conversion->jdvScale);
+}
+
+/**
+ * 处理special。支持两种：
+ *     pdf:literal 内容：原样输出到内容流
+ *     pdf:content 内容：以当前位置为原点输出
+ * 其他special一律忽略。
+ */
+static void doSpecial(PageState* s, const uint8_t* data, uint32_t length)
+{
+    static const char literal[] = "pdf:literal ";
+    static const char content[] = "pdf:content ";
+    const size_t prefixLen = sizeof(literal) - 1;
+    if (length < prefixLen) return;
+
+    if (!memcmp(data, literal, prefixLen))
+    {
+        endText(s);
+        byteBufferWrite(s->out, data + prefixLen, length - prefixLen);
+        byteBufferPutc(s->out, '\n');
+        s->textFont = NULL; // 可能改变了字体
+    }
+    else if (!memcmp(data, content, prefixLen))
+    {
+        endText(s);
+        byteBufferPrintf(s->out, "q 1 0 0 1 %.3f %.3f cm\n", pdfX(s, s->reg.h), pdfY(s, s->reg.v));
+        byteBufferWrite(s->out, data + prefixLen, length - prefixLen);
+        byteBufferPuts(s->out, "\nQ\n");
+    }
+}
+
+/**
+ * 解释一页，把生成的PDF内容流追加到缓冲区中。
+ * 只读取映射的JDV文件和已载入的字体，可在多个线程中同时调用。
+ * @param c 所属的转换
+ * @param offset 该页BOP的位置
+ * @param page 该页的序号（从0开始），用于报错
+ * @param out 输出到的缓冲区
+ * @return 成功时为1，JDV文件有错时为0
+ */
+int renderPage(const Conversion* c, uint32_t offset, int page, ByteBuffer* out)
+{
+    JdvCursor cursor;
+    JdvCommand cmd;
+    PageState s;
+    int ok = 0;
+
+    jdvCursorInit(&cursor, &c->inFile);
+    if (!jdvCursorSeek(&cursor, offset) || !jdvNextCommand(&cursor, &cmd) || cmd.type != JDV_CMD_BOP)
+        return 0;
+
+    memset(&s.reg, 0, sizeof(struct Registers));
+    s.conversion = c;
+    s.page = page;
+    s.out = out;
+    s.stackTop = 0;
+    s.stackSize = 16;
+    s.stack = malloc(s.stackSize * sizeof(struct Registers));
+    s.font = NULL;
+    s.inText = 0;
+    s.textFont = NULL;
+    s.inArray = 0;
+    s.inString = 0;
+
+    while (jdvNextCommand(&cursor, &cmd))
+    {
+        int32_t width;
+        switch (cmd.type)
+        {
+            case JDV_CMD_SET_CHAR:
+                if ((width = drawChar(&s, cmd.a)) < 0) goto end;
+                s.reg.h += width;
+                break;
+            case JDV_CMD_PUT_CHAR:
+                if (drawChar(&s, cmd.a) < 0) goto end;
+                break;
+            case JDV_CMD_SET_RULE:
+                drawRule(&s, cmd.a, cmd.b);
+                s.reg.h += cmd.b;
+                break;
+            case JDV_CMD_PUT_RULE:
+                drawRule(&s, cmd.a, cmd.b);
+                break;
+            case JDV_CMD_PUSH:
+                if (s.stackTop == s.stackSize)
+                {
+                    s.stackSize *= 2;
+                    s.stack = realloc(s.stack, s.stackSize * sizeof(struct Registers));
+                }
+                s.stack[s.stackTop++] = s.reg;
+                break;
+            case JDV_CMD_POP:
+                if (s.stackTop == 0) goto end;
+                s.reg = s.stack[--s.stackTop];
+                break;
+            case JDV_CMD_RIGHT:
+                s.reg.h += cmd.a;
+                break;
+            case JDV_CMD_W:
+                if (cmd.b) s.reg.w = cmd.a;
+                s.reg.h += s.reg.w;
+                break;
+            case JDV_CMD_X:
+                if (cmd.b) s.reg.x = cmd.a;
+                s.reg.h += s.reg.x;
+                break;
+            case JDV_CMD_DOWN:
+                s.reg.v += cmd.a;
+                break;
+            case JDV_CMD_Y:
+                if (cmd.b) s.reg.y = cmd.a;
+                s.reg.v += s.reg.y;
+                break;
+            case JDV_CMD_Z:
+                if (cmd.b) s.reg.z = cmd.a;
+                s.reg.v += s.reg.z;
+                break;
+            case JDV_CMD_FNT:
+                s.font = fontMapFind(&c->fontMap, cmd.a);
+                if (!s.font)
+                {
+                    fprintf(stderr, "第%d页选定了未定义的字体%d。", page + 1, cmd.a);
+                    goto end;
+                }
+                if (!fontTableFont(s.font))
+                {
+                    fprintf(stderr, "无法载入字体%s。", s.font->path);
+                    goto end;
+                }
+                break;
+            case JDV_CMD_XXX:
+                doSpecial(&s, cmd.data, cmd.length);
+                break;
+            case JDV_CMD_NOP:
+            case JDV_CMD_FONT_DEF: // 字体已在第一次扫描时定义，选定时载入
+                break;
+            case JDV_CMD_EOP:
+                endText(&s);
+                ok = 1;
+                goto end;
+            default: // BOP、PRE、POST等不应出现在页面中间
+                goto end;
+        }
+    }
+end:
+    free(s.stack);
+    return ok;
+}
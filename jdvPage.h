@@ -0,0 +1,13 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_JDVPAGE_H
+#define JDVPDF_JDVPAGE_H
+
+#include "byteBuffer.h"
+#include "conversion.h"
+
+int renderPage(const Conversion*, uint32_t, int, ByteBuffer*);
+
+#endif //JDVPDF_JDVPAGE_H
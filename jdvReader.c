@@ -8,102 +8,279 @@
 #include <string.h>
 
 #include "fontObject.h"
+#include "jdvCursor.h"
 #include "jdvReader.h"
 
-#define SET1        128
-#define SET_RULE    132
-#define BOP         139
-#define EOP         140
-#define XXX1        239
-#define FONT_DEF1   243
-#define PRE         247
+// 报告文件已损坏，返回0以便调用者直接返回
+inline static int corruptFile()
+{
+    fputs("JDV文件已损坏。", stderr);
+    return 0;
+}
+
+/**
+ * 根据字体定义命令记录字体的路径，字体到第一次被选定时才载入。
+ * 路径以“:序号:”开头时表示TTC中的字体序号。
+ * @param cmd 已解码的FONT_DEF命令
+ * @return 成功时为1，路径有误时为0（不报错，由调用者决定）
+ */
+static int defineFont(Conversion* c, const JdvCommand* cmd)
+{
+    char buffer[512];
+    struct FontTable* p = fontMapInsert(&c->fontMap, cmd->a); // 指向相应的序号
+    p->size = cmd->b;
+    if (!p->usedGlyphs) p->usedGlyphs = calloc(GLYPH_SET_WORDS, sizeof(uint64_t));
+    memcpy(buffer, cmd->data, cmd->length);
+    buffer[cmd->length] = 0; // 字符串结尾
+    char* path = buffer;
+    int index = 0;
+    if (*buffer == ':') // 表示有TTC中的字体序号
+    {
+        char* pos = strchr(buffer + 1, ':');
+        if (!pos) return 0;
+        *pos = 0;
+        index = atoi(buffer + 1);
+        path = pos + 1;
+    }
+    free(p->path);
+    p->path = strdup(path);
+    p->index = index;
+    p->font = NULL;
+    return 1;
+}
 
-int numPage;
+/**
+ * 由preamble中的num、den、mag算出单位：num/den×10^-7米，1bp=254000/72×10^-7米
+ */
+inline static int readPreamble(Conversion* c, const JdvCommand* cmd)
+{
+    if (cmd->type != JDV_CMD_PRE) return corruptFile();
+    c->jdvScale = (double) cmd->a / cmd->b * cmd->length / 1000 * 72 / 254000;
+    return 1;
+}
 
-int paperWidth = 595;
-int paperHeight = 842;
+/**
+ * 沿BOP中的指针从最后一页走到第一页，记录各页的位置。
+ * 每个指针都须在当前位置之前，页数也不能超过postamble中的总页数，因此损坏的文件中的指针不会形成环。
+ * @param cursor 游标
+ * @param pointer 最后一个BOP的位置
+ * @param end postamble的位置
+ * @param maxPages postamble中的总页数t
+ * @return 成功时为1，文件损坏时为0
+ */
+static int readPageChain(Conversion* c, JdvCursor* cursor, int32_t pointer, size_t end, int maxPages)
+{
+    free(c->pageOffset);
+    c->pageOffset = malloc((maxPages ? maxPages : 1) * sizeof(uint32_t));
+    c->numPage = 0;
+    while (pointer != -1)
+    {
+        if (pointer < 0 || (size_t) pointer >= end || c->numPage == maxPages) return corruptFile();
+        c->pageOffset[c->numPage++] = pointer;
+        if (!jdvCursorSeek(cursor, (size_t) pointer + 41) || !jdvCursorHas(cursor, 4)) return corruptFile();
+        end = pointer;
+        pointer = jdvReadSigned(cursor, 4);
+    }
+    // 倒过来，使其按页码顺序排列
+    for (int i=0, j=c->numPage-1; i<j; ++i, --j)
+    {
+        uint32_t tmp = c->pageOffset[i];
+        c->pageOffset[i] = c->pageOffset[j];
+        c->pageOffset[j] = tmp;
+    }
+    return 1;
+}
 
-FILE* inFile;
+/**
+ * 读入postamble中重复的字体定义，不报错。
+ * @param fontDefs postamble中字体定义的开始
+ * @return 成功时为1，其中有损坏时为0
+ */
+static int readPostambleFonts(Conversion* c, JdvCursor* cursor, size_t fontDefs)
+{
+    JdvCommand cmd;
+    if (!jdvCursorSeek(cursor, fontDefs)) return 0;
+    while (jdvNextCommand(cursor, &cmd) && cmd.type != JDV_CMD_POST_POST)
+    {
+        if (cmd.type == JDV_CMD_FONT_DEF)
+        {
+            if (!defineFont(c, &cmd)) return 0;
+        }
+        else if (cmd.type != JDV_CMD_NOP) return 0;
+    }
+    return cmd.type == JDV_CMD_POST_POST;
+}
 
-struct FontTable {
-    int size;
-    Font* font;
-} fontTable[64];
+// 从头扫描整个文件，寻找各个字体定义命令；已从postamble中读入的字体定义作废
+static int scanFontDefs(Conversion* c, JdvCursor* cursor)
+{
+    JdvCommand cmd;
+    fontMapDestruct(&c->fontMap);
+    jdvCursorInit(cursor, &c->inFile);
+    jdvNextCommand(cursor, &cmd); // preamble
+    while (jdvNextCommand(cursor, &cmd) && cmd.type != JDV_CMD_POST)
+        if (cmd.type == JDV_CMD_FONT_DEF && !defineFont(c, &cmd)) return corruptFile();
+    if (cmd.type != JDV_CMD_POST) return corruptFile();
+    return 1;
+}
 
-inline static int readJdvInt(int size, FILE* f)
+// parse1和parseMemory共用的部分：inFile已打开。成功时返回1，文件损坏时返回0
+static int parseLoaded(Conversion* c)
 {
-    int result = 0;
-    for (int i=0; i<size; ++i)
-        result = (result << 8) + fgetc(f);
-    return result;
+    JdvCursor cursor;
+    JdvCommand cmd;
+    int32_t pointer;
+
+    jdvCursorInit(&cursor, &c->inFile);
+    fontMapDestruct(&c->fontMap);
+
+    if (!jdvNextCommand(&cursor, &cmd)) return corruptFile();
+    if (!readPreamble(c, &cmd)) return 0;
+
+    // 寻找文件尾：跳过末尾的223，其前面是identification byte和postamble的位置
+    const uint8_t* end = c->inFile.data + c->inFile.size;
+    while (end > c->inFile.data && end[-1] == 223) --end;
+    if (end - c->inFile.data < 5 || !jdvCursorSeek(&cursor, end - c->inFile.data - 5)) return corruptFile();
+    pointer = jdvReadSigned(&cursor, 4); // postamble的第一字节
+    if (!jdvCursorSeek(&cursor, pointer) || !jdvNextCommand(&cursor, &cmd) || cmd.type != JDV_CMD_POST)
+        return corruptFile();
+    size_t fontDefs = jdvCursorOffset(&cursor); // postamble中字体定义的开始
+    if (!readPageChain(c, &cursor, cmd.a, pointer, cmd.b)) return 0;
+
+    // postamble中重复了所有字体定义，通常不必扫描整个文件；其中有损坏时才从头扫描
+    if (readPostambleFonts(c, &cursor, fontDefs)) return 1;
+    return scanFontDefs(c, &cursor);
 }
 
 /**
- * 第一次扫描。用于记录页数和所有字体命令。
+ * 第一次扫描。用于记录各页位置和所有字体命令。
+ * 字体定义从postamble中读取，其中有损坏时才扫描整个文件。
  * @param fileName 文件名
+ * @return 成功时为1，找不到文件或文件损坏时为0
  */
-void parse1(const char* fileName)
+int parse1(Conversion* c, const char* fileName)
 {
-    int32_t pointer;
-    int tmp;
-    char buffer[512];
-
-    inFile = fopen(fileName, "rb");
-    if (!inFile)
+    if (!jdvFileOpen(&c->inFile, fileName))
     {
         fputs("找不到指定的文件。", stderr);
-        exit(1);
+        return 0;
     }
-    // 寻找文件尾
-    fseek(inFile, -5, SEEK_END); // 跳过固定的4字节
-    while (fgetc(inFile) == 223)
-        fseek(inFile, -2, SEEK_CUR); // 向前一字节
-    // 新读的这个字节肯定是identification byte
-    fseek(inFile, -5, SEEK_CUR);
-    pointer = readJdvInt(4, inFile); // postamble的第一字节
-    fseek(inFile, pointer + 1, SEEK_SET);
-    numPage = 0;
-    while ((pointer = readJdvInt(4, inFile)) != -1)
+    return parseLoaded(c);
+}
+
+/**
+ * 同parse1，但JDV文件已在调用者的内存中，不复制，也不读写文件系统（字体除外）。
+ * @param data JDV文件的内容，转换结束前须保持有效
+ * @param size 字节数
+ * @return 成功时为1，文件损坏时为0
+ */
+int parseMemory(Conversion* c, const void* data, size_t size)
+{
+    jdvFileFromMemory(&c->inFile, data, size);
+    return parseLoaded(c);
+}
+
+/**
+ * 转换完成后关闭由parse1或parseMemory打开的文件。
+ */
+void parseClose(Conversion* c)
+{
+    jdvFileClose(&c->inFile);
+}
+
+/**
+ * 开始流式读入JDV文件，只读到preamble为止。
+ * 之后用parseStreamPage逐页读入，不需要postamble，也不在文件中回退。
+ * @param fd 文件描述符，如标准输入
+ * @return 成功时为1，文件损坏时为0；此时仍须用parseStreamClose结束
+ */
+int parseStreamOpen(Conversion* c, int fd)
+{
+    JdvCursor cursor;
+    JdvCommand cmd;
+
+    jdvStreamOpen(&c->inStream, &c->inFile, fd);
+    fontMapDestruct(&c->fontMap);
+    c->numPage = 0;
+    for (;;)
     {
-        ++numPage;
-        fseek(inFile, pointer + 41, SEEK_SET);
+        jdvCursorInit(&cursor, &c->inFile);
+        if (jdvNextCommand(&cursor, &cmd)) break;
+        if (!jdvStreamRead(&c->inStream)) return corruptFile();
     }
-    printf("%d", numPage);
+    if (!readPreamble(c, &cmd)) return 0;
+    c->streamPos = jdvCursorOffset(&cursor);
+    c->pageEnd = 0;
+    return 1;
+}
 
-    // 从头开始寻找各类font_def命令
-    fseek(inFile, 0x0El, SEEK_SET);
-    tmp = fgetc(inFile); // comment长度
-    fseek(inFile, tmp, SEEK_CUR); // 第一个BOP位置
-    while ((tmp = fgetc(inFile)) != -1)
+/**
+ * 读入下一个完整的页面。上一页的内容随即被丢弃，因此须先解释完上一页再调用。
+ * 页面之前和页面中的字体定义在遇到时记录，postamble中重复的定义则不再读取。
+ * @param offset 该页BOP在inFile中的位置
+ * @return 读到一页时为1，遇到postamble时为0，文件损坏时为-1
+ */
+int parseStreamPage(Conversion* c, uint32_t* offset)
+{
+    JdvCursor cursor;
+    JdvCommand cmd;
+    size_t pageStart = SIZE_MAX; // 尚未遇到BOP
+
+    jdvStreamDiscard(&c->inStream, c->pageEnd);
+    c->streamPos -= c->pageEnd;
+    c->pageEnd = 0;
+    for (;;)
     {
-        if (tmp < SET1){} // 1～127号，输出字符
-        else if (tmp < SET_RULE) // 128～131号，127以后的字符
-            fseek(inFile, tmp - 127, SEEK_CUR);
-        else if (tmp == BOP) // 139号命令表示BOP
-            fseek(inFile, 44l, SEEK_CUR);
-        else if (tmp >= XXX1 && tmp < FONT_DEF1) // 239～242；注释、special
-        {
-            tmp = readJdvInt(tmp - XXX1 + 1, inFile);
-            fseek(inFile, tmp, SEEK_CUR);
-        }
-        else if (tmp >= FONT_DEF1 && tmp < PRE) // 字体定义
+        jdvCursorInit(&cursor, &c->inFile);
+        jdvCursorSeek(&cursor, c->streamPos);
+        while (jdvNextCommand(&cursor, &cmd))
         {
-            tmp = readJdvInt(tmp - FONT_DEF1 + 1, inFile);
-            struct FontTable* p = fontTable + tmp; // 指向相应的序号
-            fseek(inFile, 4l, SEEK_CUR); // 不再用checksum
-            p->size = readJdvInt(4, inFile);
-            fseek(inFile, 4l, SEEK_CUR); // 不再用TFM中的size
-            tmp = fgetc(inFile);
-            tmp += fgetc(inFile); // 整个目录的长度
-            fread(buffer, 1, tmp, inFile);
-            buffer[tmp] = 0; // 字符串结尾
-            if (*buffer == ':') // 表示有TTC中的字体序号
+            switch (cmd.type)
             {
-                char* pos = strchr(buffer, ':');
-                *pos = 0;
-                p->font = fontFromFile(pos+1, atoi(buffer + 1));
+                case JDV_CMD_BOP:
+                    if (pageStart != SIZE_MAX) goto corrupt;
+                    pageStart = c->streamPos;
+                    break;
+                case JDV_CMD_EOP:
+                    if (pageStart == SIZE_MAX) goto corrupt;
+                    *offset = pageStart;
+                    c->pageEnd = c->streamPos = jdvCursorOffset(&cursor);
+                    ++c->numPage;
+                    return 1;
+                case JDV_CMD_FONT_DEF:
+                {
+                    struct FontTable* t = fontMapFind(&c->fontMap, cmd.a);
+                    if ((!t || !t->path) && !defineFont(c, &cmd)) goto corrupt;
+                    break;
+                }
+                case JDV_CMD_POST:
+                    if (pageStart != SIZE_MAX) goto corrupt;
+                    return 0;
+                case JDV_CMD_NOP:
+                    break;
+                default: // 其余命令只能出现在页面中
+                    if (pageStart == SIZE_MAX) goto corrupt;
             }
-            else p->font = fontFromFile(buffer, 0);
+            c->streamPos = jdvCursorOffset(&cursor);
         }
+
+        // 页面之间已经处理过的命令不再需要
+        if (pageStart == SIZE_MAX)
+        {
+            jdvStreamDiscard(&c->inStream, c->streamPos);
+            c->streamPos = 0;
+        }
+        if (!jdvStreamRead(&c->inStream)) goto corrupt; // 命令不完整，或在postamble之前就结束了
     }
-}
\ No newline at end of file
+corrupt:
+    corruptFile();
+    return -1;
+}
+
+/**
+ * 结束流式读入，读完并丢弃剩余的输入。
+ */
+void parseStreamClose(Conversion* c)
+{
+    jdvStreamClose(&c->inStream);
+}
@@ -5,6 +5,13 @@
 #ifndef JDVPDF_JDVREADER_H
 #define JDVPDF_JDVREADER_H
 
-void parse1(const char*);
+#include "conversion.h"
+
+int parse1(Conversion*, const char*);
+int parseMemory(Conversion*, const void*, size_t);
+void parseClose(Conversion*);
+int parseStreamOpen(Conversion*, int);
+int parseStreamPage(Conversion*, uint32_t*);
+void parseStreamClose(Conversion*);
 
 #endif //JDVPDF_JDVREADER_H
@@ -0,0 +1,175 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fontObject.h"
+#include "conversion.h"
+#include "jdvReader.h"
+#include "pdfOutput.h"
+#include "streamEncoder.h"
+#include "jdvpdf.h"
+
+/**
+ * 全部页，默认压缩级别，不使用对象流，单线程。
+ */
+void jdvpdfDefaultOptions(JdvpdfOptions* o)
+{
+    o->firstPage = 1;
+    o->lastPage = INT32_MAX;
+    o->level = STREAM_LEVEL_DEFAULT;
+    o->objectStreams = 0;
+    o->pool = NULL;
+}
+
+inline static void closeInput(Conversion* c, _Bool streaming)
+{
+    if (streaming) parseStreamClose(c);
+    else parseClose(c);
+}
+
+inline static int checkRange(const Conversion* c, int first, int last)
+{
+    if (first >= 1 && first <= last) return 1;
+    fprintf(stderr, "页码范围有误，文件共%d页。", c->numPage);
+    return 0;
+}
+
+/**
+ * 输出已读入（流式读入时为已开始读入）的JDV文件，最后关闭输入。
+ * @param last 最后一页，已按总页数修正
+ * @param write 输出函数，为NULL时在内存中生成
+ * @return 成功时为0
+ */
+static int writePdf(Conversion* c, _Bool streaming, int last, ByteSinkWriter write, void* context,
+                    const JdvpdfOptions* o)
+{
+    int ok;
+    initiatePdfOutput(c, write, context, o->level, o->objectStreams);
+    if (streaming)
+    {
+        // 读完才知道页数，页码范围此时再检查
+        int read = outputStreamPages(c, o->firstPage - 1, last - 1);
+        ok = read >= 0 && checkRange(c, o->firstPage, read);
+    }
+    else
+        ok = outputPages(c, o->firstPage - 1, last - 1, o->pool);
+    closeInput(c, streaming);
+    ok = ok && outputFonts(c, o->pool) && finalizePdfOutput(c);
+    return !ok;
+}
+
+/**
+ * 转换一个JDV文件到PDF文件。
+ * @param inName 输入文件名，为“-”时从inFd流式读入
+ * @param inFd 流式读入时的文件描述符，如标准输入
+ * @param outName 输出文件名
+ * @return 成功时为0；失败时不留下输出文件
+ */
+int jdvpdfConvertFile(const char* inName, int inFd, const char* outName, const JdvpdfOptions* o)
+{
+    Conversion c;
+    int result = 1;
+    conversionInit(&c);
+
+    _Bool streaming = strcmp(inName, "-") == 0;
+    int last = o->lastPage;
+    if (streaming)
+    {
+        if (!parseStreamOpen(&c, inFd))
+        {
+            closeInput(&c, streaming);
+            goto end;
+        }
+    }
+    else
+    {
+        if (!parse1(&c, inName)) goto end;
+        if (last > c.numPage) last = c.numPage;
+    }
+    if (!checkRange(&c, o->firstPage, last))
+    {
+        closeInput(&c, streaming);
+        goto end;
+    }
+
+    FILE* outFile = fopen(outName, "wb");
+    if (!outFile)
+    {
+        fputs("无法写入输出文件。", stderr);
+        closeInput(&c, streaming);
+        goto end;
+    }
+    result = writePdf(&c, streaming, last, byteSinkWriteFile, outFile, o);
+    struct stat st;
+    _Bool regular = fstat(fileno(outFile), &st) == 0 && S_ISREG(st.st_mode);
+    if (fclose(outFile) && !result) // 缓冲区中剩余的内容写不进去
+    {
+        fputs("无法写入输出文件。", stderr);
+        result = 1;
+    }
+    if (result && regular) unlink(outName); // 删除不完整的文件，但不删除设备等
+end:
+    conversionDestruct(&c);
+    return result;
+}
+
+// 转换内存中的JDV文件，结束后不释放c
+static int convertMemory(Conversion* c, const void* jdv, size_t size, ByteSinkWriter write, void* context,
+                         const JdvpdfOptions* o)
+{
+    if (!parseMemory(c, jdv, size)) return 1;
+    int last = o->lastPage < c->numPage ? o->lastPage : c->numPage;
+    if (!checkRange(c, o->firstPage, last))
+    {
+        parseClose(c);
+        return 1;
+    }
+    return writePdf(c, 0, last, write, context, o);
+}
+
+/**
+ * 转换内存中的JDV文件，PDF文件分块交给write。除读取字体外不访问文件系统。
+ * @param jdv JDV文件的内容，不复制
+ * @param size 字节数
+ * @param write 输出函数，每次得到PDF文件中接下来的一块；返回0时转换失败，不再调用write
+ * @param context 传给write的第一个参数
+ * @return 成功时为0；失败时已交给write的内容不是完整的PDF文件，须由调用者丢弃
+ */
+int jdvpdfConvertMemory(const void* jdv, size_t size, ByteSinkWriter write, void* context,
+                        const JdvpdfOptions* o)
+{
+    Conversion c;
+    conversionInit(&c);
+    int result = convertMemory(&c, jdv, size, write, context, o);
+    conversionDestruct(&c);
+    return result;
+}
+
+/**
+ * 转换内存中的JDV文件，把PDF文件追加到pdf中。pdf为空时直接取得生成时的缓冲区，不再复制。
+ * @param pdf 已初始化的缓冲区，由调用者释放
+ * @return 成功时为0；失败时pdf不变
+ */
+int jdvpdfConvertToBuffer(const void* jdv, size_t size, ByteBuffer* pdf, const JdvpdfOptions* o)
+{
+    Conversion c;
+    conversionInit(&c);
+    int result = convertMemory(&c, jdv, size, NULL, NULL, o);
+    if (result == 0 && pdf->size == 0)
+    {
+        byteBufferDestruct(pdf);
+        *pdf = c.output.buffer;
+        byteBufferConstruct(&c.output.buffer);
+    }
+    else if (result == 0)
+        byteBufferWrite(pdf, c.output.buffer.data, c.output.buffer.size);
+    conversionDestruct(&c);
+    return result;
+}
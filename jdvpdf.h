@@ -0,0 +1,34 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_JDVPDF_H
+#define JDVPDF_JDVPDF_H
+
+#include "byteBuffer.h"
+#include "byteSink.h"
+#include "threadPool.h"
+
+/*
+ * 作为库使用时的入口。调用前须先用initiateFontLibrary初始化字体库，
+ * 各函数可在多个线程中同时调用，已载入的字体在各次转换间共用。
+ * 各函数不会退出程序：JDV文件或字体损坏、无法输出时在stderr上输出错误信息，
+ * 释放这次转换占用的资源后返回非0值，不影响其他转换。
+ */
+
+// 转换的选项
+typedef struct {
+    int firstPage; // 第一页，从1开始
+    int lastPage; // 最后一页（含），可超过总页数
+    int level; // stream的压缩级别，0为不压缩
+    _Bool objectStreams; // 是否使用对象流和交叉引用流（PDF 1.5）
+    ThreadPool* pool; // 用于解释页面的线程池，可为NULL
+} JdvpdfOptions;
+
+void jdvpdfDefaultOptions(JdvpdfOptions*);
+
+int jdvpdfConvertFile(const char*, int, const char*, const JdvpdfOptions*);
+int jdvpdfConvertMemory(const void*, size_t, ByteSinkWriter, void*, const JdvpdfOptions*);
+int jdvpdfConvertToBuffer(const void*, size_t, ByteBuffer*, const JdvpdfOptions*);
+
+#endif //JDVPDF_JDVPDF_H
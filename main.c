@@ -1,24 +1,356 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <getopt.h>
 #include "fontObject.h"
-#include "pdfOutput.h"
-//#include "jdvReader.h"
+#include "streamEncoder.h"
+#include "jdvpdf.h"
 
-int main() {
-    //initiateFontLibrary();
-    //Font* testFont = fontFromFile("/usr/share/fonts/opentype/noto/NotoSerifCJK-Regular.ttc",2);
-    //Font* testFont2 = fontFromFile("/usr/share/fonts/opentype/noto/NotoSerifCJK-Regular.ttc",2);
-    //Font* testFont3 = fontFromFile("/usr/share/fonts/opentype/freefont/FreeSerif.otf",2);
+static const char usage[] = "用法：jdvpdf [--pages 起始页-结束页] [--jobs 线程数] [--compress 压缩级别0～9] [--object-streams] 输入文件 输出文件\n"
+                            "      jdvpdf [选项] --batch 列表文件或目录\n"
+                            "      jdvpdf [选项] --serve 套接字路径\n"
+                            "输入文件为“-”时从标准输入逐页读入并输出。\n"
+                            "列表文件每行为“输入文件<Tab>输出文件”，为“-”时从标准输入读取；\n"
+                            "给出目录时转换其中所有的.jdv文件，输出到同名的.pdf文件。\n"
+                            "服务模式下每个连接发送一行“输入文件<Tab>输出文件[<Tab>页码范围]”，\n"
+                            "输入文件为“-”时其后紧接JDV文件的内容；转换完成后回复“OK”或“ERROR”。\n"
+                            "字体信息缓存在环境变量JDVPDF_FONT_CACHE指定的文件中（默认为~/.cache/jdvpdf-fonts.cache，为空时不缓存）。\n";
 
-    FILE* outFile = fopen("test.txt", "wb");
-    initiatePdfOutput(outFile);
-    //outputFont(testFont, 0);
-    finalizePdfOutput();
+// 各文件共用的选项，转换时只读
+static JdvpdfOptions convertOptions;
 
-    //deleteFontLibrary();
-    //fclose(outFile);
+/**
+ * 解析页码范围，如“120-135”、“7”、“120-”（到最后一页）。
+ * @return 格式正确时为1
+ */
+static int parsePageRange(const char* str, int* first, int* last)
+{
+    char* end;
+    *first = strtol(str, &end, 10);
+    if (end == str) return 0;
+    if (*end == 0)
+    {
+        *last = *first;
+        return 1;
+    }
+    if (*end != '-') return 0;
+    str = end + 1;
+    if (*str == 0)
+    {
+        *last = INT32_MAX;
+        return 1;
+    }
+    *last = strtol(str, &end, 10);
+    return end != str && *end == 0;
+}
+
+/**
+ * 转换目录中所有的.jdv文件，输出到同一目录中同名的.pdf文件。
+ * @return 出错的文件数
+ */
+static int convertDirectory(const char* dirName)
+{
+    DIR* dir = opendir(dirName);
+    if (!dir)
+    {
+        fprintf(stderr, "无法打开目录%s。", dirName);
+        return 1;
+    }
+    int failed = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)))
+    {
+        size_t length = strlen(entry->d_name);
+        if (length <= 4 || strcmp(entry->d_name + length - 4, ".jdv") != 0) continue;
+        char* inName = malloc(strlen(dirName) + length + 2);
+        sprintf(inName, "%s/%s", dirName, entry->d_name);
+        char* outName = strdup(inName);
+        strcpy(outName + strlen(outName) - 4, ".pdf");
+        if (jdvpdfConvertFile(inName, STDIN_FILENO, outName, &convertOptions))
+        {
+            fprintf(stderr, "（%s）\n", inName);
+            ++failed;
+        }
+        free(inName);
+        free(outName);
+    }
+    closedir(dir);
+    return failed;
+}
 
-    //parse1("/home/david/文档/新软件五线谱、简谱排版需求.dvi");
+/**
+ * 按列表转换多个文件。空行和以“#”开头的行被忽略。
+ * @return 出错的文件数
+ */
+static int convertList(const char* listName)
+{
+    FILE* list = strcmp(listName, "-") == 0 ? stdin : fopen(listName, "r");
+    if (!list)
+    {
+        fprintf(stderr, "无法打开列表文件%s。", listName);
+        return 1;
+    }
+    int failed = 0;
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, list)) > 0)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = 0;
+        if (length == 0 || *line == '#') continue;
+        char* tab = strchr(line, '\t');
+        if (!tab)
+        {
+            fprintf(stderr, "列表中的“%s”缺少输出文件。\n", line);
+            ++failed;
+            continue;
+        }
+        *tab = 0;
+        if (jdvpdfConvertFile(line, STDIN_FILENO, tab + 1, &convertOptions))
+        {
+            fprintf(stderr, "（%s）\n", line);
+            ++failed;
+        }
+    }
+    free(line);
+    if (list != stdin) fclose(list);
+    return failed;
+}
+
+static volatile sig_atomic_t stopServer;
+
+static void onStopSignal(int sig)
+{
+    (void) sig;
+    stopServer = 1;
+}
 
+/**
+ * 从连接中读取一行请求，不多读，以免读走其后的JDV文件内容。
+ * @return 成功时为1，连接在行尾之前断开或行太长时为0
+ */
+static int readRequestLine(int fd, char* buffer, size_t size)
+{
+    for (size_t n=0; n+1<size; ++n)
+    {
+        ssize_t got;
+        do got = read(fd, buffer + n, 1);
+        while (got < 0 && errno == EINTR);
+        if (got <= 0) return 0;
+        if (buffer[n] == '\n')
+        {
+            if (n > 0 && buffer[n - 1] == '\r') --n;
+            buffer[n] = 0;
+            return 1;
+        }
+    }
     return 0;
 }
+
+/**
+ * 处理一个连接中的转换请求。请求中没有页码范围时使用命令行中的页码范围。
+ * @return 成功时为0
+ */
+static int serveRequest(int fd)
+{
+    char line[4096];
+    if (!readRequestLine(fd, line, sizeof(line))) return 1;
+    char* outName = strchr(line, '\t');
+    if (!outName) return 1;
+    *outName++ = 0;
+    char* range = strchr(outName, '\t');
+    JdvpdfOptions o = convertOptions;
+    if (range)
+    {
+        *range++ = 0;
+        if (!parsePageRange(range, &o.firstPage, &o.lastPage)) return 1;
+    }
+    return jdvpdfConvertFile(line, fd, outName, &o);
+}
+
+// 各连接在自己的线程中处理；退出前等待所有连接处理完
+
+static pthread_mutex_t connectionLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connectionDone = PTHREAD_COND_INITIALIZER;
+static int numConnections;
+
+static void* serveConnection(void* arg)
+{
+    int fd = (int) (intptr_t) arg;
+    const char* reply = serveRequest(fd) ? "ERROR\n" : "OK\n";
+    write(fd, reply, strlen(reply));
+    close(fd);
+
+    pthread_mutex_lock(&connectionLock);
+    --numConnections;
+    pthread_cond_broadcast(&connectionDone);
+    pthread_mutex_unlock(&connectionLock);
+    return NULL;
+}
+
+/**
+ * 在Unix套接字上等待转换请求，直到收到SIGINT或SIGTERM。各连接在不同线程中同时转换。
+ * 字体库和线程池在各请求间保留，已载入的字体不必重新读取。
+ * 请求中直接发送JDV文件内容时，客户端发完后应关闭连接的写入端，再等待回复。
+ * 调用前须已在所有线程中阻塞SIGINT和SIGTERM（见main），这两个信号只在pselect等待时接收，
+ * 因此不会被其他线程接收，也不会在检查stopServer之后、开始等待之前到达而被错过。
+ * 套接字只有本用户可以连接。
+ * @param path 套接字路径，已有的同名文件会被删除
+ * @return 出错时为1
+ */
+static int serve(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fputs("套接字路径太长。", stderr);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    mode_t oldMask = umask(0177); // 套接字文件的权限为0600
+    int bound = server >= 0 && bind(server, (struct sockaddr*) &address, sizeof(address)) == 0;
+    umask(oldMask);
+    if (!bound || listen(server, 16) < 0 || server >= FD_SETSIZE)
+    {
+        fprintf(stderr, "无法在%s上监听。", path);
+        if (server >= 0) close(server);
+        return 1;
+    }
+    // 连接在pselect返回后、accept之前被客户端放弃时，accept不应阻塞
+    fcntl(server, F_SETFL, fcntl(server, F_GETFL) | O_NONBLOCK);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN); // 客户端提前断开时不退出
+
+    // 等待时解除对SIGINT和SIGTERM的阻塞
+    sigset_t waitMask;
+    pthread_sigmask(SIG_BLOCK, NULL, &waitMask);
+    sigdelset(&waitMask, SIGINT);
+    sigdelset(&waitMask, SIGTERM);
+
+    while (!stopServer)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(server, &readable);
+        if (pselect(server + 1, &readable, NULL, NULL, NULL, &waitMask) <= 0) continue; // 收到信号
+        int fd = accept(server, NULL, NULL);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK); // 有的系统上会继承O_NONBLOCK
+        pthread_mutex_lock(&connectionLock);
+        ++numConnections;
+        pthread_mutex_unlock(&connectionLock);
+
+        pthread_t thread;
+        void* arg = (void*) (intptr_t) fd;
+        if (pthread_create(&thread, NULL, serveConnection, arg) == 0)
+            pthread_detach(thread);
+        else
+            serveConnection(arg);
+    }
+    close(server);
+    unlink(path);
+
+    pthread_mutex_lock(&connectionLock);
+    while (numConnections > 0)
+        pthread_cond_wait(&connectionDone, &connectionLock);
+    pthread_mutex_unlock(&connectionLock);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option options[] = {
+            {"pages", required_argument, NULL, 'p'},
+            {"jobs", required_argument, NULL, 'j'},
+            {"compress", required_argument, NULL, 'z'},
+            {"object-streams", no_argument, NULL, 'O'},
+            {"batch", required_argument, NULL, 'b'},
+            {"serve", required_argument, NULL, 's'},
+            {NULL, 0, NULL, 0}
+    };
+    int numThreads = 1;
+    jdvpdfDefaultOptions(&convertOptions);
+    const char* batch = NULL;
+    const char* socketPath = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:j:z:Ob:s:", options, NULL)) != -1)
+    {
+        if (opt == 'p' && parsePageRange(optarg, &convertOptions.firstPage, &convertOptions.lastPage)) continue;
+        if (opt == 'j' && (numThreads = atoi(optarg)) > 0) continue;
+        if (opt == 'z' && (convertOptions.level = atoi(optarg)) >= 0 && convertOptions.level <= 9) continue;
+        if (opt == 'O')
+        {
+            convertOptions.objectStreams = 1;
+            continue;
+        }
+        if (opt == 'b')
+        {
+            batch = optarg;
+            continue;
+        }
+        if (opt == 's')
+        {
+            socketPath = optarg;
+            continue;
+        }
+        fputs(usage, stderr);
+        return 1;
+    }
+    if (batch || socketPath ? argc != optind : argc - optind < 2)
+    {
+        fputs(usage, stderr);
+        return 1;
+    }
+
+    if (socketPath)
+    {
+        // 在创建任何线程之前阻塞，使线程池和各连接的线程都不接收这两个信号，只由serve在等待时接收
+        sigset_t stopSignals;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGINT);
+        sigaddset(&stopSignals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+    }
+
+    initiateFontLibrary();
+    ThreadPool* pool = numThreads > 1 ? threadPoolNew(numThreads) : NULL;
+    convertOptions.pool = pool;
+    int result;
+    if (socketPath)
+        result = serve(socketPath);
+    else if (!batch)
+        result = jdvpdfConvertFile(argv[optind], STDIN_FILENO, argv[optind + 1], &convertOptions);
+    else
+    {
+        struct stat st;
+        int failed = stat(batch, &st) == 0 && S_ISDIR(st.st_mode) ?
+                convertDirectory(batch) : convertList(batch);
+        if (failed) fprintf(stderr, "有%d个文件转换失败。", failed);
+        result = failed != 0;
+    }
+    if (pool) threadPoolFree(pool);
+    deleteFontLibrary();
+    return result;
+}
@@ -4,152 +4,814 @@
 
 /*
  * PDF文件架构大概这样：
- * 1～3号对象为文件头（1号顶点，2号Pages，3号ProcSet）
- * 4～7号对象用于Symbols这个CID字体，存储各种特殊符号。
- * 一个CID字体需要5个对象存储，按顺序分别为（其他字体同理）
+ * 1～4号对象的编号预先保留（1号顶点，2号ProcSet，3号Pages，4号记录所有字体的dictionary），
+ * 其中3号和4号引用的对象要到最后才知道，因此在所有页面和字体之后才输出。
+ * 其余对象的编号在输出时按顺序分配，因此不必事先知道页数和字体数，可以边解释边输出。
+ * 每页需要三个对象，分别为页面、页面内容（stream）、stream的长度。
+ * 一个CID字体需要5个对象存储，按顺序分别为
  *     第1个：Type0字体
  *     第2个：CID Type 0字体
  *     第3个：FontDescriptor
  *     第4个：存储字体内容的stream
  *     第5个：stream的长度
- * Symbols因长度已知，且不需要子集化，因此不需要把长度另外占一个object。
- * 自8号对象起，每三个对象对应一页，分别为页面、页面内容（stream）、stream的长度。
- * 在所有页面对象结束之后，储存用到的其他OTF/TTF字体，仍旧用5个对象存储一个字体。
- * 最后一个对象是一个dictionary，它储存了所有字体的名称及其对象索引。
+ * Symbols这个存储各种特殊符号的CID字体尚未实现，暂不占用对象。
+ *
+ * 对象流模式（PDF 1.5）下，stream以外的对象不直接写入文件，而是依次加入对象流，
+ * 每满OBJSTM_CAPACITY个对象编码输出一次；最后用交叉引用流代替xref表。
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <pthread.h>
 
+#include "byteBuffer.h"
+#include "byteSink.h"
 #include "fontObject.h"
 #include "pdfOutput.h"
-#include "fontWriter.h"
+#include "fontOutput.h"
+#include "jdvReader.h"
+#include "jdvPage.h"
+#include "streamEncoder.h"
+#include "threadPool.h"
 
-unsigned objCount;
+#define CATALOG_OBJ 1
+#define PROCSET_OBJ 2
+#define PAGES_OBJ 3
+#define FONT_DICT_OBJ 4
 
-FILE* outFile;
+// 交叉引用表中的一项
+struct XrefEntry {
+    _Bool compressed; // 为1时对象在对象流中
+    uint64_t offset; // 对象在文件中的位置；在对象流中时为对象流的编号
+    unsigned index; // 在对象流中的序号
+};
 
-long startByte[512];
-char buffer[1024];
+#define OBJSTM_CAPACITY 100
 
-#define RECORD_OBJ_POS startByte[objCount++] = ftell(outFile)
+/**
+ * 写出编码器对应的/Filter，结束stream的字典，再写出stream的内容。
+ * @param stream 已编码的内容
+ */
+static void writeStreamBody(Conversion* c, const ByteBuffer* stream)
+{
+    if (c->streamEncoder.filter)
+    {
+        byteSinkPuts(&c->output, " /Filter ");
+        byteSinkPuts(&c->output, c->streamEncoder.filter);
+    }
+    byteSinkPuts(&c->output, ">>\nstream\n");
+    byteSinkWrite(&c->output, stream->data, stream->size);
+    byteSinkPuts(&c->output, "\nendstream\nendobj\n");
+}
 
-extern int numPage;
-int numFont;
-extern int paperWidth, paperHeight;
+// 写出“n 0 R”
+inline static void putReference(ByteSink* s, unsigned num)
+{
+    byteSinkPutUnsigned(s, num);
+    byteSinkPuts(s, " 0 R");
+}
 
-void initiatePdfOutput(FILE* f)
+/**
+ * 确保xref中有num号对象的位置。容量按倍数增长，使追加的均摊代价为O(1)。
+ */
+static void reserveXref(Conversion* c, unsigned num)
 {
-    outFile = f;
+    if (num < c->xrefCapacity) return;
+    unsigned capacity = c->xrefCapacity ? c->xrefCapacity : 1024;
+    while (capacity <= num) capacity *= 2;
+    c->xref = realloc(c->xref, capacity * sizeof(struct XrefEntry));
+    c->xrefCapacity = capacity;
+}
 
-    numPage = 5; // 测试用
+// 取得num号对象的交叉引用项
+inline static struct XrefEntry* xrefEntry(Conversion* c, unsigned num)
+{
+    reserveXref(c, num);
+    return c->xref + num;
+}
 
-    // 文件头
-    fputs("%PDF-1.4\n", outFile);
+// 记录对象在文件中的位置，并写出“n 0 obj”
+inline static void writeObjectHeader(Conversion* c, unsigned num)
+{
+    struct XrefEntry* e = xrefEntry(c, num);
+    e->compressed = 0;
+    e->offset = byteSinkOffset(&c->output);
+    byteSinkPutUnsigned(&c->output, num);
+    byteSinkPuts(&c->output, " 0 obj\n");
+}
 
-    // 1号对象
-    fputs("1 0 obj\n<</Type /Catalog /Pages 3 0 R>>\nendobj\n", outFile);
+/**
+ * 分配一个对象编号。编号可以先被引用，对象本身可在此后任何时候输出。
+ */
+static unsigned allocObject(Conversion* c)
+{
+    reserveXref(c, ++c->objCount);
+    return c->objCount;
+}
 
-    // 2号对象
-    fputs("2 0 obj\n[/PDF /Text]\nendobj\n", outFile);
+/**
+ * 开始生成一个非stream对象。内容写入objectBody中，写完后调用endObject。
+ */
+inline static void beginObject(Conversion* c)
+{
+    byteSinkClear(&c->objectBody);
+}
+
+/**
+ * 开始输出一个stream对象。stream对象总是直接写入文件。
+ * @param num 对象编号
+ */
+inline static void beginStreamObject(Conversion* c, unsigned num)
+{
+    writeObjectHeader(c, num);
+}
+
+// 编码并输出当前的对象流
+static void flushObjectStream(Conversion* c)
+{
+    if (c->objStmCount == 0) return;
+    ByteBuffer encoded;
+    byteBufferConstruct(&encoded);
+    size_t first = c->objStmOffsets.buffer.size;
+    byteSinkWrite(&c->objStmOffsets, c->objStmObjects.buffer.data, c->objStmObjects.buffer.size);
+    const ByteBuffer* stream = streamEncode(&c->streamEncoder, &c->objStmOffsets.buffer, &encoded);
+    if (!stream)
+    {
+        c->outputFailed = 1; // 由finalizePdfOutput报告
+        goto end;
+    }
+
+    writeObjectHeader(c, c->objStmNum);
+    byteSinkPuts(&c->output, "<</Type /ObjStm /N ");
+    byteSinkPutUnsigned(&c->output, c->objStmCount);
+    byteSinkPuts(&c->output, " /First ");
+    byteSinkPutUnsigned(&c->output, first);
+    byteSinkPuts(&c->output, " /Length ");
+    byteSinkPutUnsigned(&c->output, stream->size);
+    writeStreamBody(c, stream);
+
+end:
+    byteBufferDestruct(&encoded);
+    byteSinkClear(&c->objStmOffsets);
+    byteSinkClear(&c->objStmObjects);
+    c->objStmCount = 0;
+}
+
+/**
+ * 输出objectBody中的对象：对象流模式下加入对象流，否则直接写入文件。
+ * @param num 对象编号
+ */
+static void endObject(Conversion* c, unsigned num)
+{
+    if (!c->useObjectStreams)
+    {
+        writeObjectHeader(c, num);
+        byteSinkWrite(&c->output, c->objectBody.buffer.data, c->objectBody.buffer.size);
+        byteSinkPuts(&c->output, "\nendobj\n");
+        return;
+    }
+
+    if (c->objStmCount == 0) c->objStmNum = allocObject(c);
+    byteSinkPutUnsigned(&c->objStmOffsets, num);
+    byteSinkPutc(&c->objStmOffsets, ' ');
+    byteSinkPutUnsigned(&c->objStmOffsets, c->objStmObjects.buffer.size);
+    byteSinkPutc(&c->objStmOffsets, ' ');
+    byteSinkWrite(&c->objStmObjects, c->objectBody.buffer.data, c->objectBody.buffer.size);
+    byteSinkPutc(&c->objStmObjects, '\n');
+    struct XrefEntry* e = xrefEntry(c, num);
+    e->compressed = 1;
+    e->offset = c->objStmNum;
+    e->index = c->objStmCount++;
+    if (c->objStmCount == OBJSTM_CAPACITY) flushObjectStream(c);
+}
+
+/**
+ * 开始输出PDF文件。页数和字体数不必事先知道。
+ * @param write 输出函数，如byteSinkWriteFile；为NULL时在内存中生成，结束后留在c->output.buffer中
+ * @param context 传给write的第一个参数，如FILE*
+ * @param level stream的压缩级别，0为不压缩
+ * @param objectStreams 是否使用对象流和交叉引用流（PDF 1.5）
+ */
+void initiatePdfOutput(Conversion* c, ByteSinkWriter write, void* context, int level, _Bool objectStreams)
+{
+    byteSinkConstructWriter(&c->output, write, context);
+    streamEncoderInit(&c->streamEncoder, level);
+    c->useObjectStreams = objectStreams;
+    c->outputFailed = 0;
+    c->objCount = 0;
+    c->objStmCount = 0;
+    c->numOutputPage = 0;
+    for (unsigned i=CATALOG_OBJ; i<=FONT_DICT_OBJ; ++i)
+        allocObject(c);
 
-    // 3号对象
-    fputs("3 0 obj\n<</Type /Pages /Kids [", outFile);
-    for (int i=0; i<numPage; ++i)
-        fprintf(outFile, "%d 0 R ", i*3+8);
-    fprintf(outFile, "] /Count %d>>\nendobj\n", numPage);
+    // 文件头
+    byteSinkPuts(&c->output, c->useObjectStreams ? "%PDF-1.5\n" : "%PDF-1.4\n");
 
-    // 已经测试出的固定值
-    objCount = 3;
-    startByte[0] = 9;
-    startByte[1] = 56;
-    startByte[2] = 84;
+    beginObject(c);
+    byteSinkPuts(&c->objectBody, "<</Type /Catalog /Pages 3 0 R>>");
+    endObject(c, CATALOG_OBJ);
 
+    beginObject(c);
+    byteSinkPuts(&c->objectBody, "[/PDF /Text]");
+    endObject(c, PROCSET_OBJ);
 }
 
-void outputPage()
+/**
+ * 输出一页的各对象，并记下页面对象的编号。页面按输出的顺序排列。
+ * @param content 已编码的页面内容
+ */
+static void writePage(Conversion* c, const ByteBuffer* content)
 {
+    unsigned pageObj = allocObject(c);
+    unsigned contentObj = allocObject(c);
+    unsigned lengthObj = allocObject(c);
+    if (c->numOutputPage == c->pageObjCapacity)
+    {
+        c->pageObjCapacity = c->pageObjCapacity ? c->pageObjCapacity * 2 : 64;
+        c->pageObjs = realloc(c->pageObjs, c->pageObjCapacity * sizeof(unsigned));
+    }
+    c->pageObjs[c->numOutputPage++] = pageObj;
+
     // 页面顶
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n<</Type /Page /Parent 3 0 R /MediaBox [0 0 %d %d] /Contents %d 0 R "
-                     "/Resources <</ProcSet 2 0 R /Fonts %d 0 R>>\n>>\nendobj\n",
-            objCount, paperWidth, paperHeight, objCount + 1, 7 + 3 * numPage + 5 * numFont);
+    beginObject(c);
+    byteSinkPuts(&c->objectBody, "<</Type /Page /Parent 3 0 R /MediaBox [0 0 ");
+    byteSinkPutSigned(&c->objectBody, c->paperWidth);
+    byteSinkPutc(&c->objectBody, ' ');
+    byteSinkPutSigned(&c->objectBody, c->paperHeight);
+    byteSinkPuts(&c->objectBody, "] /Contents ");
+    putReference(&c->objectBody, contentObj);
+    byteSinkPuts(&c->objectBody, " /Resources <</ProcSet 2 0 R /Font 4 0 R>>\n>>");
+    endObject(c, pageObj);
 
     // 页面内容
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n<</Length %d 0 R>>\nstream\n", objCount, objCount + 1);
-    int streamLen = ftell(outFile) * -1;
-    // 待完成部分
-
-    streamLen += ftell(outFile);
-    fputs("\nendstream\nendobj\n", outFile);
+    beginStreamObject(c, contentObj);
+    byteSinkPuts(&c->output, "<</Length ");
+    putReference(&c->output, lengthObj);
+    writeStreamBody(c, content);
 
     // 文件长度
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n%d\nendobj\n", objCount, streamLen);
+    beginObject(c);
+    byteSinkPutUnsigned(&c->objectBody, content->size);
+    endObject(c, lengthObj);
+}
+
+// 报告出错的页，返回0以便调用者直接返回
+inline static int pageError(int page)
+{
+    fprintf(stderr, "第%d页有错误。", page + 1);
+    return 0;
+}
+
+/**
+ * 解释并输出位于offset处的一页。
+ * @param page 该页在JDV文件中的序号（从0开始），用于报错
+ * @return 成功时为1，该页有错时为0
+ */
+static int outputPageAt(Conversion* c, uint32_t offset, int page)
+{
+    ByteBuffer content, encoded;
+    byteBufferConstruct(&content);
+    byteBufferConstruct(&encoded);
+    const ByteBuffer* stream = NULL;
+    if (renderPage(c, offset, page, &content)) stream = streamEncode(&c->streamEncoder, &content, &encoded);
+    if (stream) writePage(c, stream);
+    byteBufferDestruct(&content);
+    byteBufferDestruct(&encoded);
+    return stream ? 1 : pageError(page);
+}
+
+/**
+ * 输出一页。
+ * @param page 该页在JDV文件中的序号（从0开始）
+ * @return 成功时为1，该页有错时为0
+ */
+int outputPage(Conversion* c, int page)
+{
+    return outputPageAt(c, c->pageOffset[page], page);
 }
 
 /**
- * 按照是否子集化输出字体。
- * @param f 字体对象
- * @param subset 是否子集化
+ * 流式读入时，边读边输出各页。各页在读入后立即解释，不等待后面的内容。
+ * @param first 第一页的序号（从0开始）
+ * @param last 最后一页的序号（含）
+ * @return 读到的页数，出错时为-1
  */
-void outputFont(Font* f, _Bool subset)
+int outputStreamPages(Conversion* c, int first, int last)
 {
+    uint32_t offset;
+    int page = 0;
+    int got;
+    while (page <= last && (got = parseStreamPage(c, &offset)) != 0)
+    {
+        if (got < 0 || (page >= first && !outputPageAt(c, offset, page))) return -1;
+        ++page;
+    }
+    return page;
+}
+
+/*
+ * 多线程输出时，各工作线程把页面解释到各自的缓冲区中并编码，
+ * 再由调用outputPages的线程按页码顺序写入文件并记录对象位置。
+ * 同时解释的页数不超过线程数的两倍，以免占用过多内存。
+ */
+struct PageJob {
+    Conversion* conversion;
+    pthread_mutex_t* lock; // 同一次outputPages的各任务共用
+    pthread_cond_t* done;
+    int page;
+    int state; // 0为尚未完成，1为完成，-1为出错
+    ByteBuffer content;
+    ByteBuffer encoded;
+    const ByteBuffer* stream; // 编码后的内容，指向content或encoded
+};
+
+static void renderJob(void* arg)
+{
+    struct PageJob* job = arg;
+    Conversion* c = job->conversion;
+    byteBufferClear(&job->content);
+    job->stream = NULL;
+    if (renderPage(c, c->pageOffset[job->page], job->page, &job->content))
+        job->stream = streamEncode(&c->streamEncoder, &job->content, &job->encoded);
+
+    pthread_mutex_lock(job->lock);
+    job->state = job->stream ? 1 : -1;
+    pthread_cond_broadcast(job->done);
+    pthread_mutex_unlock(job->lock);
+}
+
+/**
+ * 输出JDV文件中连续的若干页。
+ * @param first 第一页的序号（从0开始）
+ * @param last 最后一页的序号（含）
+ * @param pool 用于解释页面的线程池；为NULL时在当前线程中逐页解释
+ * @return 成功时为1，有一页出错时为0
+ */
+int outputPages(Conversion* c, int first, int last, ThreadPool* pool)
+{
+    if (!pool)
+    {
+        for (int i=first; i<=last; ++i)
+            if (!outputPage(c, i)) return 0;
+        return 1;
+    }
+
+    pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+    int window = 2 * threadPoolSize(pool);
+    if (window > last - first + 1) window = last - first + 1;
+    struct PageJob* jobs = malloc(window * sizeof(struct PageJob));
+    for (int i=0; i<window; ++i)
+    {
+        jobs[i].conversion = c;
+        jobs[i].lock = &jobLock;
+        jobs[i].done = &jobDone;
+        jobs[i].page = first + i;
+        jobs[i].state = 0;
+        byteBufferConstruct(&jobs[i].content);
+        byteBufferConstruct(&jobs[i].encoded);
+        threadPoolSubmit(pool, renderJob, jobs + i);
+    }
+
+    int ok = 1;
+    for (int i=first; i<=last; ++i)
+    {
+        struct PageJob* job = jobs + (i - first) % window;
+        pthread_mutex_lock(&jobLock);
+        while (job->state == 0)
+            pthread_cond_wait(&jobDone, &jobLock);
+        pthread_mutex_unlock(&jobLock);
+        if (job->state < 0)
+        {
+            ok = pageError(i);
+            break;
+        }
+
+        writePage(c, job->stream);
+
+        // 该缓冲区已经写完，用来解释后面的页
+        if (i + window <= last)
+        {
+            job->page = i + window;
+            job->state = 0;
+            threadPoolSubmit(pool, renderJob, job);
+        }
+    }
+
+    // 出错时不再提交新的任务，但须等已提交的任务结束才能释放缓冲区
+    pthread_mutex_lock(&jobLock);
+    for (int i=0; i<window; ++i)
+        while (jobs[i].state == 0)
+            pthread_cond_wait(&jobDone, &jobLock);
+    pthread_mutex_unlock(&jobLock);
+
+    for (int i=0; i<window; ++i)
+    {
+        byteBufferDestruct(&jobs[i].content);
+        byteBufferDestruct(&jobs[i].encoded);
+    }
+    free(jobs);
+    pthread_mutex_destroy(&jobLock);
+    pthread_cond_destroy(&jobDone);
+    return ok;
+}
+
+/**
+ * 输出CIDFont的/W数组。GID连续的字形写在同一个子数组中。
+ * @param numGID 字形数
+ * @param GIDs 按升序排列的GID
+ */
+static void outputWidths(Conversion* c, Font* f, size_t numGID, const uint16_t* GIDs)
+{
+    byteSinkPuts(&c->objectBody, " /W [");
+    for (size_t i=0; i<numGID; ++i)
+    {
+        unsigned gid = GIDs[i];
+        if (i == 0 || GIDs[i - 1] != gid - 1)
+        {
+            if (i) byteSinkPuts(&c->objectBody, "] ");
+            byteSinkPutUnsigned(&c->objectBody, gid);
+            byteSinkPuts(&c->objectBody, " [");
+        }
+        else
+            byteSinkPutc(&c->objectBody, ' ');
+        byteSinkPutSigned(&c->objectBody, fontGlyphWidthPdf(f, gid));
+    }
+    byteSinkPuts(&c->objectBody, numGID ? "]]" : "]");
+}
+/*
+ * 字体的嵌入文件只取决于字体本身和字形集合，可以在工作线程中生成并编码，
+ * 再由调用outputFonts的线程按顺序写入各对象。同时生成的字体数不超过线程数的两倍。
+ */
+struct FontJob {
+    Font* font;
+    const uint64_t* usedGlyphs;
+    const StreamEncoder* encoder;
+    pthread_mutex_t* lock; // 同一次outputFonts的各任务共用
+    pthread_cond_t* done;
+    int finished;
+    size_t numGID;
+    uint16_t* GIDs; // 按升序排列
+    ByteSink fontData;
+    ByteBuffer encoded;
+    const ByteBuffer* stream; // 编码后的嵌入文件，指向fontData.buffer或encoded
+};
+
+static void fontJobConstruct(struct FontJob* job, Conversion* c, Font* f, const uint64_t* usedGlyphs)
+{
+    job->font = f;
+    job->usedGlyphs = usedGlyphs;
+    job->encoder = &c->streamEncoder;
+    job->lock = NULL;
+    job->done = NULL;
+    job->finished = 0;
+    job->numGID = 0;
+    job->GIDs = NULL;
+    byteSinkConstruct(&job->fontData, NULL);
+    byteBufferConstruct(&job->encoded);
+}
+
+static void fontJobDestruct(struct FontJob* job)
+{
+    free(job->GIDs);
+    byteSinkDestruct(&job->fontData);
+    byteBufferDestruct(&job->encoded);
+}
+
+/**
+ * 生成并编码嵌入文件，不涉及PDF对象，可在任何线程中执行。出错时job->stream为NULL。
+ */
+static void renderFont(struct FontJob* job)
+{
+    Font* f = job->font;
+    job->GIDs = malloc(65536 * sizeof(uint16_t));
+    job->numGID = listGlyphs(job->usedGlyphs, job->GIDs);
+    int rendered = f->isOTF ? outputSubsetCFF(job->numGID, job->GIDs, f, &job->fontData)
+                            : outputSubsetSFNT(job->numGID, job->GIDs, f, &job->fontData);
+    job->stream = rendered ? streamEncode(job->encoder, &job->fontData.buffer, &job->encoded) : NULL;
+}
+
+static void fontJobTask(void* arg)
+{
+    struct FontJob* job = arg;
+    renderFont(job);
+
+    pthread_mutex_lock(job->lock);
+    job->finished = 1;
+    pthread_cond_broadcast(job->done);
+    pthread_mutex_unlock(job->lock);
+}
+
+/**
+ * 输出字体的各对象，嵌入文件须已由renderFont生成。
+ * @return Type0字体的对象编号，嵌入文件生成失败时为0
+ */
+static unsigned writeFont(Conversion* c, const struct FontJob* job)
+{
+    Font* f = job->font;
+    if (!job->stream)
+    {
+        fprintf(stderr, "无法输出字体%s。", f->CIDFontName);
+        return 0;
+    }
+    unsigned num = allocObject(c);
+    for (int i=1; i<5; ++i)
+        allocObject(c); // 依次为CID字体、FontDescriptor、stream、stream的长度
+
     // Type0字体
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n<</Type /Font /Subtype /Type0 /BaseFont /%s /Encoding /Identity-H "
-                    "/DescendantFonts %d 0 R>>\nendobj\n", objCount, f->T0FontName, objCount + 1);
+    beginObject(c);
+    byteSinkPrintf(&c->objectBody, "<</Type /Font /Subtype /Type0 /BaseFont /%s /Encoding /Identity-H "
+                                     "/DescendantFonts [%u 0 R]>>", f->T0FontName, num + 1);
+    endObject(c, num);
 
     // CID字体
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n<</Type /Font /Subtype /CIDFontType%d /BaseFont /%s\n"
-                    "/CIDSystemInfo << /Registry (Adobe) /Ordering (%s) /Supplement %d>>\n"
-                    "/FontDescriptor %d 0 R>>\nendobj\n", objCount, f->isOTF?0:2, f->CIDFontName,
-            orderings[f->ROS / 256], f->ROS % 256, objCount + 1);
-
-    // FontDescriptor
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n<</Type /FontDescriptor /FontName /%s /Flags 4 /FontBBox [%d %d %d %d] "
-                    "/ItalicAngle 0 /Ascent %d /Descent %d /CapHeight %d /StemV 0 /FontFile%d %d 0 R>>\n"
-                    "endobj\n", objCount, f->CIDFontName, f->BBox[0], f->BBox[1], f->BBox[2], f->BBox[3],
-            f->ascent, f->descent, f->capsHeight, f->isOTF?3:2, objCount + 1);
+    beginObject(c);
+    byteSinkPrintf(&c->objectBody, "<</Type /Font /Subtype /CIDFontType%d /BaseFont /%s\n"
+                                     "/CIDSystemInfo << /Registry (Adobe) /Ordering (%s) /Supplement %d>>\n"
+                                     "/FontDescriptor %u 0 R%s", f->isOTF?0:2, f->CIDFontName,
+            orderings[f->ROS / 256], f->ROS % 256, num + 2, f->isOTF ? "" : " /CIDToGIDMap /Identity");
+    outputWidths(c, f, job->numGID, job->GIDs);
+    byteSinkPuts(&c->objectBody, ">>");
+    endObject(c, num + 1);
+
+    // FontDescriptor，各值须换算为以1000为1em
+#define TO_PDF_UNIT(x) ((int) (x) * 1000 / f->unitsPerEm)
+    beginObject(c);
+    byteSinkPrintf(&c->objectBody, "<</Type /FontDescriptor /FontName /%s /Flags 4 /FontBBox [%d %d %d %d] "
+                                     "/ItalicAngle 0 /Ascent %d /Descent %d /CapHeight %d /StemV 0 /FontFile%d %u 0 R>>",
+            f->CIDFontName, TO_PDF_UNIT(f->BBox[0]), TO_PDF_UNIT(f->BBox[1]),
+            TO_PDF_UNIT(f->BBox[2]), TO_PDF_UNIT(f->BBox[3]), TO_PDF_UNIT(f->ascent), TO_PDF_UNIT(f->descent),
+            TO_PDF_UNIT(f->capsHeight), f->isOTF?3:2, num + 3);
+    endObject(c, num + 2);
+#undef TO_PDF_UNIT
 
     // 嵌入文件
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n<<", objCount);
-    int32_t streamLen = 0;
-    if (f->isOTF)
-    {
-        fprintf(outFile, "/Length %d 0 R /Subtype /CIDFontType0C>>\nstream\n", objCount + 1);
-        streamLen = ftell(outFile) * -1;
-        outputSubsetCFF(0, NULL, f);
-    }
+    const ByteBuffer* stream = job->stream;
+    beginStreamObject(c, num + 3);
+    byteSinkPuts(&c->output, "<</Length ");
+    putReference(&c->output, num + 4);
+    if (f->isOTF) byteSinkPuts(&c->output, " /Subtype /CIDFontType0C");
     else
     {
-        fprintf(outFile, "/Length %d 0 R /Length1 %d 0 R>>\nstream\n", objCount + 1, objCount + 1);
-        streamLen = ftell(outFile) * -1;
-        outputSubsetSFNT(0, NULL, f);
+        byteSinkPuts(&c->output, " /Length1 ");
+        byteSinkPutUnsigned(&c->output, job->fontData.buffer.size);
     }
-    streamLen += ftell(outFile);
-    fputs("\nendstream\nendobj\n", outFile);
+    writeStreamBody(c, stream);
 
     // 文件长度
-    RECORD_OBJ_POS;
-    fprintf(outFile, "%d 0 obj\n%d\nendobj\n", objCount, streamLen);
+    beginObject(c);
+    byteSinkPutUnsigned(&c->objectBody, stream->size);
+    endObject(c, num + 4);
+    return num;
 }
 
-void finalizePdfOutput()
+/**
+ * 按对象编号的顺序输出字体表中的所有字体，最后输出记录各字体名称的dictionary。
+ * 字体按页面中实际用到的字形子集化；同一字体对应多个字体号时，合并各字体号的字形集合。
+ * @param pool 用于子集化的线程池；为NULL时在当前线程中逐个输出
+ * @return 成功时为1，有字体无法输出时为0
+ */
+int outputFonts(Conversion* c, ThreadPool* pool)
 {
-    // 输出交叉引用表
-    long xrefPos = ftell(outFile);
-    fprintf(outFile, "xref\n0 %d\n0000000000 65535 f\n", objCount + 1);
-    for (int i=0; i<objCount; ++i)
-        fprintf(outFile, "%010ld 00000 n\n", startByte[i]);
+    // 同一字体可能对应多个字体号（大小不同），只输出一次
+    int numFonts = 0;
+    Font** fonts = malloc(c->fontMap.numEntries * sizeof(Font*));
+    uint64_t* glyphs = malloc(c->fontMap.numEntries * GLYPH_SET_WORDS * sizeof(uint64_t));
+    for (int i=0; i<c->fontMap.numEntries; ++i)
+    {
+        struct FontTable* t = c->fontMap.entries[i];
+        if (!t->font) continue;
+        int j = 0;
+        while (j < numFonts && fonts[j] != t->font) ++j;
+        uint64_t* set = glyphs + (size_t) j * GLYPH_SET_WORDS;
+        if (j == numFonts)
+        {
+            fonts[numFonts++] = t->font;
+            memcpy(set, t->usedGlyphs, GLYPH_SET_WORDS * sizeof(uint64_t));
+            set[0] |= 1; // .notdef必须保留
+        }
+        else
+            for (int k=0; k<GLYPH_SET_WORDS; ++k)
+                set[k] |= t->usedGlyphs[k];
+    }
+
+    pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+    int window = pool ? 2 * threadPoolSize(pool) : 1;
+    if (window > numFonts) window = numFonts;
+    struct FontJob* jobs = malloc(window * sizeof(struct FontJob));
+    for (int i=0; i<window && pool; ++i)
+    {
+        fontJobConstruct(jobs + i, c, fonts[i], glyphs + (size_t) i * GLYPH_SET_WORDS);
+        jobs[i].lock = &jobLock;
+        jobs[i].done = &jobDone;
+        threadPoolSubmit(pool, fontJobTask, jobs + i);
+    }
+
+    unsigned* pdfObj = malloc(numFonts * sizeof(unsigned));
+    int ok = 1;
+    for (int i=0; i<numFonts && ok; ++i)
+    {
+        struct FontJob* job = jobs + i % window;
+        if (pool)
+        {
+            pthread_mutex_lock(&jobLock);
+            while (!job->finished)
+                pthread_cond_wait(&jobDone, &jobLock);
+            pthread_mutex_unlock(&jobLock);
+        }
+        else
+        {
+            fontJobConstruct(job, c, fonts[i], glyphs + (size_t) i * GLYPH_SET_WORDS);
+            renderFont(job);
+        }
+        ok = (pdfObj[i] = writeFont(c, job)) != 0;
+        fontJobDestruct(job);
+
+        // 该任务已经写完，用来生成后面的字体
+        if (ok && pool && i + window < numFonts)
+        {
+            fontJobConstruct(job, c, fonts[i + window], glyphs + (size_t) (i + window) * GLYPH_SET_WORDS);
+            job->lock = &jobLock;
+            job->done = &jobDone;
+            threadPoolSubmit(pool, fontJobTask, job);
+        }
 
-    // 输出trailer
-    fprintf(outFile, "trailer\n<</Size %d /Root 1 0 R>>\nstartxref\n%ld\n%%%%EOF",
-            objCount + 1, xrefPos);
+        // 出错时不再提交新的任务，等已提交的任务结束
+        for (int j=i+1; !ok && pool && j<numFonts && j<i+window; ++j)
+        {
+            job = jobs + j % window;
+            pthread_mutex_lock(&jobLock);
+            while (!job->finished)
+                pthread_cond_wait(&jobDone, &jobLock);
+            pthread_mutex_unlock(&jobLock);
+            fontJobDestruct(job);
+        }
+    }
+    free(jobs);
+    pthread_mutex_destroy(&jobLock);
+    pthread_cond_destroy(&jobDone);
+
+    for (int i=0; i<c->fontMap.numEntries; ++i)
+    {
+        struct FontTable* t = c->fontMap.entries[i];
+        t->pdfObj = 0;
+        for (int j=0; j<numFonts; ++j)
+            if (fonts[j] == t->font) t->pdfObj = pdfObj[j];
+    }
+    free(pdfObj);
+    free(glyphs);
+    free(fonts);
+    if (!ok) return 0;
+
+    beginObject(c);
+    byteSinkPuts(&c->objectBody, "<<");
+    for (int i=0; i<c->fontMap.numEntries; ++i)
+        if (c->fontMap.entries[i]->font)
+        {
+            byteSinkPuts(&c->objectBody, "/F");
+            byteSinkPutSigned(&c->objectBody, c->fontMap.entries[i]->number);
+            byteSinkPutc(&c->objectBody, ' ');
+            putReference(&c->objectBody, c->fontMap.entries[i]->pdfObj);
+            byteSinkPutc(&c->objectBody, ' ');
+        }
+    byteSinkPuts(&c->objectBody, ">>");
+    endObject(c, FONT_DICT_OBJ);
+    return 1;
+}
+
+/**
+ * 输出交叉引用流。每项为1字节的类型、位置（或对象流编号）和2字节的序号，
+ * 位置的字节数按最大值决定。
+ */
+static void writeXrefStream(Conversion* c)
+{
+    flushObjectStream(c);
+    unsigned num = allocObject(c);
+    uint64_t xrefPos = byteSinkOffset(&c->output);
+    struct XrefEntry* e = xrefEntry(c, num);
+    e->compressed = 0;
+    e->offset = xrefPos;
+
+    int offsetSize = 1;
+    while (offsetSize < 8 && (xrefPos >> (offsetSize * 8))) ++offsetSize;
+
+    ByteSink content;
+    ByteBuffer encoded;
+    byteSinkConstruct(&content, NULL);
+    byteBufferConstruct(&encoded);
+    byteSinkPutBE(&content, 0, 1); // 0号对象
+    byteSinkPutBE(&content, 0, offsetSize);
+    byteSinkPutBE(&content, 65535, 2);
+    for (unsigned i=1; i<=num; ++i)
+    {
+        byteSinkPutBE(&content, c->xref[i].compressed ? 2 : 1, 1);
+        byteSinkPutBE(&content, c->xref[i].offset, offsetSize);
+        byteSinkPutBE(&content, c->xref[i].compressed ? c->xref[i].index : 0, 2);
+    }
+    const ByteBuffer* stream = streamEncode(&c->streamEncoder, &content.buffer, &encoded);
+    if (!stream)
+    {
+        c->outputFailed = 1;
+        goto end;
+    }
+
+    byteSinkPrintf(&c->output, "%u 0 obj\n<</Type /XRef /Size %u /W [1 %d 2] /Root 1 0 R /Length %zu",
+            num, num + 1, offsetSize, stream->size);
+    writeStreamBody(c, stream);
+    byteSinkPuts(&c->output, "startxref\n");
+    byteSinkPutUnsigned(&c->output, xrefPos);
+    byteSinkPuts(&c->output, "\n%%EOF");
+
+end:
+    byteSinkDestruct(&content);
+    byteBufferDestruct(&encoded);
+}
+
+// 交叉引用表中的位置只有10位十进制数，更大的文件须用交叉引用流
+#ifndef MAX_XREF_OFFSET
+#define MAX_XREF_OFFSET 9999999999ULL
+#endif
+
+// 交叉引用表中的一行，位置为10位十进制数，每行恰为20字节
+static void putXrefLine(Conversion* c, uint64_t offset)
+{
+    char* p = byteSinkReserve(&c->output, 20);
+    memcpy(p, "0000000000 00000 n \n", 20);
+    for (int i=9; i>=0 && offset; --i)
+    {
+        p[i] = (char) ('0' + offset % 10);
+        offset /= 10;
+    }
+    byteSinkCommit(&c->output, 20);
+}
+
+// 各对象在文件中的最大位置
+static uint64_t maxObjectOffset(const Conversion* c)
+{
+    uint64_t max = 0;
+    for (unsigned i=1; i<=c->objCount; ++i)
+        if (c->xref[i].offset > max) max = c->xref[i].offset;
+    return max;
+}
+
+/**
+ * 结束PDF文件：输出页面树的根（3号对象）和交叉引用。
+ * 不用对象流时，若有对象的位置超过交叉引用表所能记录的10位数，则不输出交叉引用表而报错：
+ * 此时文件头已写为PDF 1.4，不能再改用交叉引用流。
+ * @return 成功时为1，此前生成对象流等时出错、文件太大或无法写入时为0
+ */
+int finalizePdfOutput(Conversion* c)
+{
+    beginObject(c);
+    byteSinkPuts(&c->objectBody, "<</Type /Pages /Kids [");
+    for (int i=0; i<c->numOutputPage; ++i)
+    {
+        putReference(&c->objectBody, c->pageObjs[i]);
+        byteSinkPutc(&c->objectBody, ' ');
+    }
+    byteSinkPuts(&c->objectBody, "] /Count ");
+    byteSinkPutUnsigned(&c->objectBody, c->numOutputPage);
+    byteSinkPuts(&c->objectBody, ">>");
+    endObject(c, PAGES_OBJ);
+
+    if (c->useObjectStreams)
+    {
+        writeXrefStream(c);
+    }
+    else if (maxObjectOffset(c) > MAX_XREF_OFFSET)
+    {
+        fputs("PDF文件太大，交叉引用表无法记录对象的位置，须使用对象流（--object-streams）。", stderr);
+        c->outputFailed = 1;
+    }
+    else
+    {
+        // 输出交叉引用表
+        uint64_t xrefPos = byteSinkOffset(&c->output);
+        byteSinkPrintf(&c->output, "xref\n0 %u\n0000000000 65535 f \n", c->objCount + 1);
+        for (unsigned i=1; i<=c->objCount; ++i)
+            putXrefLine(c, c->xref[i].offset);
+
+        // 输出trailer
+        byteSinkPrintf(&c->output, "trailer\n<</Size %u /Root 1 0 R>>\nstartxref\n", c->objCount + 1);
+        byteSinkPutUnsigned(&c->output, xrefPos);
+        byteSinkPuts(&c->output, "\n%%EOF");
+    }
+
+    byteSinkFlush(&c->output); // 输出到内存时，整个文件留在c->output.buffer中
+    if (c->output.failed)
+    {
+        fputs("无法写入输出文件。", stderr);
+        c->outputFailed = 1;
+    }
+    free(c->xref);
+    c->xref = NULL;
+    c->xrefCapacity = 0;
+    free(c->pageObjs);
+    c->pageObjs = NULL;
+    c->pageObjCapacity = 0;
+    if (c->outputFailed) fputs("无法生成PDF文件。", stderr);
+    return !c->outputFailed;
 }
\ No newline at end of file
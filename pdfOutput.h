@@ -5,10 +5,17 @@
 #ifndef JDVPDF_PDFOUTPUT_H
 #define JDVPDF_PDFOUTPUT_H
 
-void initiatePdfOutput(FILE*);
+#include "threadPool.h"
+#include "conversion.h"
 
-void outputFont(Font*, _Bool);
+void initiatePdfOutput(Conversion*, ByteSinkWriter, void*, int, _Bool);
 
-void finalizePdfOutput();
+int outputPage(Conversion*, int);
+int outputPages(Conversion*, int, int, ThreadPool*);
+int outputStreamPages(Conversion*, int, int);
+
+int outputFonts(Conversion*, ThreadPool*);
+
+int finalizePdfOutput(Conversion*);
 
 #endif //JDVPDF_PDFOUTPUT_H
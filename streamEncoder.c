@@ -0,0 +1,90 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <zlib.h>
+
+#include "streamEncoder.h"
+
+// z_stream中的avail_in、avail_out只是uInt，更大的stream分块送入
+#ifndef FLATE_CHUNK
+#define FLATE_CHUNK UINT_MAX
+#endif
+
+// FlateDecode，即zlib格式。成功时返回1
+static int flateEncode(const StreamEncoder* e, const void* data, size_t size, ByteBuffer* out)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z_stream));
+    if (deflateInit(&z, e->level) != Z_OK)
+    {
+        fputs("无法初始化zlib。", stderr);
+        return 0;
+    }
+    // deflateBound给出的空间足以压缩完
+    byteBufferReserve(out, out->size + deflateBound(&z, size));
+    size_t inLeft = size; // 尚未交给zlib的输入
+    size_t room = out->capacity - out->size;
+    size_t outLeft = room; // 尚未交给zlib的输出空间
+    z.next_in = (Bytef*) data;
+    z.next_out = (Bytef*) out->data + out->size;
+    int status = Z_OK;
+    while (status == Z_OK)
+    {
+        if (z.avail_in == 0 && inLeft)
+        {
+            z.avail_in = inLeft > FLATE_CHUNK ? FLATE_CHUNK : (uInt) inLeft;
+            inLeft -= z.avail_in;
+        }
+        if (z.avail_out == 0)
+        {
+            z.avail_out = outLeft > FLATE_CHUNK ? FLATE_CHUNK : (uInt) outLeft;
+            outLeft -= z.avail_out;
+        }
+        status = deflate(&z, inLeft ? Z_NO_FLUSH : Z_FINISH);
+    }
+    deflateEnd(&z);
+    if (status != Z_STREAM_END)
+    {
+        fputs("压缩时出错。", stderr);
+        return 0;
+    }
+    out->size += room - outLeft - z.avail_out;
+    return 1;
+}
+
+/**
+ * 按压缩级别选择编码器。
+ * @param level 0表示不压缩，1～9为FlateDecode的压缩级别
+ */
+void streamEncoderInit(StreamEncoder* e, int level)
+{
+    e->level = level;
+    if (level == STREAM_LEVEL_NONE)
+    {
+        e->filter = NULL;
+        e->encode = NULL;
+    }
+    else
+    {
+        e->filter = "/FlateDecode";
+        e->encode = flateEncode;
+    }
+}
+
+/**
+ * 编码stream的内容。
+ * @param content 原内容
+ * @param encoded 存放编码结果的缓冲区，会先被清空
+ * @return 编码后的内容；不编码时直接返回content，出错时为NULL
+ */
+const ByteBuffer* streamEncode(const StreamEncoder* e, const ByteBuffer* content, ByteBuffer* encoded)
+{
+    if (!e->encode) return content;
+    byteBufferClear(encoded);
+    return e->encode(e, content->data, content->size, encoded) ? encoded : NULL;
+}
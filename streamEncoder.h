@@ -0,0 +1,30 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_STREAMENCODER_H
+#define JDVPDF_STREAMENCODER_H
+
+#include "byteBuffer.h"
+
+/*
+ * 流编码器：把stream的内容编码（压缩）后追加到缓冲区中，并给出流字典中相应的/Filter。
+ * 编码器本身不保存中间状态，可在多个线程中同时使用。
+ */
+typedef struct StreamEncoder_ StreamEncoder;
+
+struct StreamEncoder_ {
+    const char* filter; // 流字典中/Filter的值，如"/FlateDecode"；为NULL时不编码
+    int level; // 压缩级别
+    int (*encode)(const StreamEncoder*, const void*, size_t, ByteBuffer*); // 成功时返回1
+};
+
+// 不压缩
+#define STREAM_LEVEL_NONE 0
+// zlib默认的压缩级别
+#define STREAM_LEVEL_DEFAULT 6
+
+void streamEncoderInit(StreamEncoder*, int);
+const ByteBuffer* streamEncode(const StreamEncoder*, const ByteBuffer*, ByteBuffer*);
+
+#endif //JDVPDF_STREAMENCODER_H
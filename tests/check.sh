@@ -0,0 +1,346 @@
+#!/bin/sh
+#
+# 编译jdvpdf和测试工具，生成测试用的JDV文件，逐项检查转换结果。
+# 用法：tests/check.sh [TrueType字体文件]
+# 字体也可由环境变量JDVPDF_TEST_FONT给出，都没有时用DejaVu Sans，找不到则跳过（返回77）。
+# 编译器和选项可由CC、CFLAGS给出，如CFLAGS="-g -fsanitize=address"。
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+FONT=${1:-${JDVPDF_TEST_FONT:-}}
+if [ -z "$FONT" ] && command -v fc-match >/dev/null 2>&1; then
+    FONT=$(fc-match -f '%{file}' 'DejaVu Sans:fontformat=TrueType')
+fi
+[ -n "$FONT" ] || FONT=/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf
+if [ ! -f "$FONT" ]; then
+    echo "找不到测试用的TrueType字体，跳过测试。"
+    exit 77
+fi
+
+CC=${CC:-cc}
+TIMEOUT=
+command -v timeout >/dev/null 2>&1 && TIMEOUT="timeout 60" # 损坏的文件不应使转换陷入死循环
+CFLAGS=${CFLAGS:--O2}
+export JDVPDF_FONT_CACHE= # 不读写字体信息缓存
+
+T=$(mktemp -d) || exit 1
+SERVER=
+trap '[ -n "$SERVER" ] && kill "$SERVER" 2>/dev/null; rm -rf "$T"' EXIT
+
+$CC -std=gnu11 -Wall $CFLAGS -o "$T/jdvpdf" *.c -lz -lpthread -lm || exit 1
+# 压缩时把输入和输出分成很小的块，检查分块送入zlib的结果与一次送入相同
+$CC -std=gnu11 -Wall $CFLAGS -DFLATE_CHUNK=7 -o "$T/jdvpdfChunked" *.c -lz -lpthread -lm || exit 1
+# 交叉引用表只能记录不超过999的位置，模拟超过10^10字节的文件
+$CC -std=gnu11 -Wall $CFLAGS -DMAX_XREF_OFFSET=999 -o "$T/jdvpdfSmallXref" *.c -lz -lpthread -lm || exit 1
+$CC -std=gnu11 -Wall $CFLAGS -I. -o "$T/jdvTest" tests/jdvTest.c $(ls *.c | grep -v '^main\.c$') -lz -lpthread -lm || exit 1
+JDVPDF=$T/jdvpdf
+JDVTEST=$T/jdvTest
+
+"$JDVTEST" write basic "$T/basic.jdv" "$FONT" || exit 1
+"$JDVTEST" write opcodes "$T/opcodes.jdv" "$FONT" || exit 1
+"$JDVTEST" write badpage "$T/badpage.jdv" "$FONT" || exit 1
+"$JDVTEST" write nofont "$T/nofont.jdv" "$FONT" || exit 1
+"$JDVTEST" write biggid "$T/biggid.jdv" "$FONT" || exit 1
+"$JDVTEST" write cycle "$T/cycle.jdv" "$FONT" || exit 1
+"$JDVTEST" write pagecount "$T/pagecount.jdv" "$FONT" || exit 1
+"$JDVTEST" write postfonts "$T/postfonts.jdv" "$FONT" || exit 1
+
+passed=0
+failed=0
+
+# 执行一项检查：check 名称 命令...
+check()
+{
+    name=$1
+    shift
+    if "$@" >"$T/log" 2>&1; then
+        passed=$((passed + 1))
+        echo "通过：$name"
+    else
+        failed=$((failed + 1))
+        echo "失败：$name"
+        sed 's/^/    /' "$T/log"
+    fi
+}
+
+# 未压缩的PDF中各页的内容流，去掉TJ数组中的字距调整（其值与字体有关）
+content()
+{
+    sed -n '/^<<\/Length [0-9]* 0 R>>$/,/^endstream$/p' "$1" | sed 's/>-\{0,1\}[0-9]*<//g'
+}
+
+# 每种命令各自改变了哪些寄存器，由pdf:content输出的坐标看出
+test_opcodes()
+{
+    "$JDVPDF" -z 0 "$T/opcodes.jdv" "$T/opcodes.pdf" || return 1
+    content "$T/opcodes.pdf" >"$T/opcodes.txt"
+    for line in 'q 1 0 0 1 101.000 842.000 cm' 'q 1 0 0 1 301.000 842.000 cm' \
+            'q 1 0 0 1 301.000 741.000 cm' 'q 1 0 0 1 301.000 541.000 cm' \
+            'q 1 0 0 1 0.000 842.000 cm' '/F300 10.000 Tf' '1 0 0 1 0.000 342.000 Tm' \
+            '[<004100C8012C010100420190>] TJ'; do
+        grep -qxF "$line" "$T/opcodes.txt" || { echo "缺少：$line"; return 1; }
+    done
+}
+
+# 同一基线上的字形合并为一个TJ，Tf只在换字体时输出
+test_runs()
+{
+    "$JDVPDF" -z 0 "$T/basic.jdv" "$T/basic.pdf" || return 1
+    content "$T/basic.pdf" >"$T/basic.txt"
+    [ "$(grep -c ' Tf$' "$T/basic.txt")" -eq 3 ] || { echo "Tf的个数有误"; return 1; }
+    [ "$(grep -c ' Tm$' "$T/basic.txt")" -eq 6 ] || { echo "Tm的个数有误"; return 1; }
+    [ "$(grep -cxF '[<002400250026>] TJ' "$T/basic.txt")" -eq 3 ] || { echo "第一行文字有误"; return 1; }
+    [ "$(grep -cxF '[<00270028>] TJ' "$T/basic.txt")" -eq 3 ] || { echo "第二行文字有误"; return 1; }
+}
+
+# 页码范围：test_pages 范围 页数，页数为空表示应当失败
+test_pages()
+{
+    if [ -z "$2" ]; then
+        ! "$JDVPDF" --pages "$1" "$T/basic.jdv" "$T/pages.pdf"
+    else
+        "$JDVPDF" --pages "$1" "$T/basic.jdv" "$T/pages.pdf" && grep -qa "/Count $2>>" "$T/pages.pdf"
+    fi
+}
+
+# 从标准输入流式读入的结果应与从文件读入的相同
+test_stdin()
+{
+    "$JDVPDF" "$@" "$T/basic.jdv" "$T/file.pdf" || return 1
+    "$JDVPDF" "$@" - "$T/stdin.pdf" <"$T/basic.jdv" || return 1
+    cmp "$T/file.pdf" "$T/stdin.pdf"
+}
+
+# 多线程解释页面的结果应与单线程的相同
+test_jobs()
+{
+    "$JDVPDF" -j 1 "$T/basic.jdv" "$T/j1.pdf" || return 1
+    "$JDVPDF" -j 4 "$T/basic.jdv" "$T/j4.pdf" || return 1
+    cmp "$T/j1.pdf" "$T/j4.pdf"
+}
+
+test_xref()
+{
+    "$JDVPDF" -z 0 "$T/basic.jdv" "$T/xref.pdf" || return 1
+    head -c 8 "$T/xref.pdf" | grep -q '^%PDF-1\.4' || return 1
+    "$JDVTEST" checkxref "$T/xref.pdf"
+}
+
+test_object_streams()
+{
+    "$JDVPDF" -O -z 0 "$T/basic.jdv" "$T/objstm.pdf" || return 1
+    head -c 8 "$T/objstm.pdf" | grep -q '^%PDF-1\.5' || return 1
+    grep -qa '/Type /ObjStm' "$T/objstm.pdf" || { echo "没有对象流"; return 1; }
+    grep -qa '/Type /XRef' "$T/objstm.pdf" || { echo "没有交叉引用流"; return 1; }
+    "$JDVTEST" checkxref "$T/objstm.pdf" || return 1
+    "$JDVPDF" -O "$T/basic.jdv" "$T/objstm9.pdf"
+}
+
+# CID字体子集化后Top DICT变短，FDArray中Private DICT的位置随之前移
+test_cid_font()
+{
+    "$JDVTEST" cidfont "$T/cid.otf" || return 1
+    "$JDVTEST" write basic "$T/cid.jdv" "$T/cid.otf" || return 1
+    "$JDVPDF" -z 0 "$T/cid.jdv" "$T/cid.pdf" || return 1
+    "$JDVTEST" checkcid "$T/cid.pdf"
+}
+
+# postamble中的字体定义损坏时从头扫描，结果不变
+test_postamble_fonts()
+{
+    "$JDVPDF" "$T/basic.jdv" "$T/postbasic.pdf" || return 1
+    "$JDVPDF" "$T/postfonts.jdv" "$T/postfonts.pdf" || return 1
+    cmp "$T/postbasic.pdf" "$T/postfonts.pdf"
+}
+
+# 压缩的结果与分块大小无关
+test_flate_chunks()
+{
+    "$JDVPDF" "$@" "$T/basic.jdv" "$T/whole.pdf" || return 1
+    "$T/jdvpdfChunked" "$@" "$T/basic.jdv" "$T/chunked.pdf" || return 1
+    cmp "$T/whole.pdf" "$T/chunked.pdf"
+}
+
+# 对象的位置超出交叉引用表的范围时报错，不输出错误的位置；交叉引用流则没有这个限制
+test_xref_overflow()
+{
+    rm -f "$T/overflow.pdf"
+    ! "$T/jdvpdfSmallXref" "$T/basic.jdv" "$T/overflow.pdf" && [ ! -e "$T/overflow.pdf" ] || return 1
+    "$T/jdvpdfSmallXref" -O -z 0 "$T/basic.jdv" "$T/overflow.pdf" && "$JDVTEST" checkxref "$T/overflow.pdf"
+}
+
+# 无法写入输出文件（磁盘已满）时报错
+test_disk_full()
+{
+    ! "$JDVPDF" "$@" /dev/full 2>"$T/full.err" && grep -q '无法写入输出文件' "$T/full.err"
+}
+
+# 损坏的JDV文件：报错并返回1，不能崩溃
+test_corrupt()
+{
+    $TIMEOUT "$JDVPDF" "$@" "$T/corrupt.pdf" 2>"$T/corrupt.err"
+    status=$?
+    cat "$T/corrupt.err"
+    [ $status -eq 1 ] && grep -q 'JDV文件已损坏' "$T/corrupt.err"
+}
+
+# 解释页面时出错：返回1，不留下不完整的输出文件
+test_bad_page()
+{
+    rm -f "$T/badpage.pdf"
+    ! "$JDVPDF" "$@" "$T/badpage.pdf" && [ ! -e "$T/badpage.pdf" ]
+}
+
+# 选定未定义的字体：报告页码和字体号
+test_undefined_font()
+{
+    ! "$JDVPDF" "$@" "$T/nofont.jdv" "$T/nofont.pdf" 2>"$T/nofont.err" || return 1
+    cat "$T/nofont.err"
+    grep -q '第2页选定了未定义的字体5' "$T/nofont.err"
+}
+
+# GID超过0xFFFF：报错，不截断
+test_big_glyph()
+{
+    ! "$JDVPDF" "$@" "$T/biggid.pdf" 2>"$T/biggid.err" || return 1
+    cat "$T/biggid.err"
+    grep -q '第3页的字形号65536超出范围' "$T/biggid.err"
+}
+
+# 损坏的字体：test_bad_font 种类 应有的错误信息，信息为空表示应当成功。报错时返回1，不能崩溃
+test_bad_font()
+{
+    "$JDVTEST" badfont "$1" "$FONT" "$T/bad_$1.ttf" || return 1
+    "$JDVTEST" write basic "$T/bad_$1.jdv" "$T/bad_$1.ttf" || return 1
+    "$JDVPDF" "$T/bad_$1.jdv" "$T/bad_$1.pdf" 2>"$T/badfont.err"
+    status=$?
+    cat "$T/badfont.err"
+    if [ -z "$2" ]; then
+        [ $status -eq 0 ] && "$JDVTEST" checkxref "$T/bad_$1.pdf"
+    else
+        [ $status -eq 1 ] && grep -q "$2" "$T/badfont.err"
+    fi
+}
+
+# 字体信息缓存中的记录不合理时整个丢弃，重新解析字体，结果与不用缓存时相同
+test_font_cache()
+{
+    rm -f "$T/fonts.cache"
+    "$JDVPDF" "$T/basic.jdv" "$T/nocache.pdf" || return 1
+    JDVPDF_FONT_CACHE=$T/fonts.cache "$JDVPDF" "$T/basic.jdv" "$T/cache1.pdf" || return 1
+    [ -s "$T/fonts.cache" ] || { echo "没有生成缓存文件"; return 1; }
+    # 第一条记录的unitsPerEm（16字节的文件头之后，记录中的第32字节）改为0
+    printf '\000\000' | dd of="$T/fonts.cache" bs=1 seek=48 conv=notrunc 2>/dev/null || return 1
+    JDVPDF_FONT_CACHE=$T/fonts.cache "$JDVPDF" "$T/basic.jdv" "$T/cache2.pdf" || return 1
+    cmp "$T/nocache.pdf" "$T/cache1.pdf" && cmp "$T/nocache.pdf" "$T/cache2.pdf"
+}
+
+# 作为库使用时，出错的转换不退出程序，之后的转换照常进行
+test_library()
+{
+    "$JDVTEST" convert "$1" "$T/truncated.jdv" "$T/basic.jdv" "$T/badpage.jdv" "$T/basic.jdv" >"$T/library.txt" || return 1
+    printf 'ERROR\nOK\nERROR\nOK\n' | cmp - "$T/library.txt"
+}
+
+check "命令解码" test_opcodes
+check "TJ合并" test_runs
+check "页码范围2-3" test_pages 2-3 2
+check "页码范围3" test_pages 3 1
+check "页码范围2-" test_pages 2- 2
+check "页码范围超出" test_pages 5-9 ""
+check "流式读入" test_stdin
+check "流式读入页码范围" test_stdin --pages 2-3
+check "多线程" test_jobs
+check "分块压缩" test_flate_chunks
+check "分块压缩（对象流）" test_flate_chunks -O
+check "交叉引用表" test_xref
+check "CFF INDEX重复写出" $TIMEOUT "$JDVTEST" cffindex
+check "CID字体的Private DICT位置" test_cid_font
+check "对象流和交叉引用流" test_object_streams
+check "交叉引用表的位置超出范围" test_xref_overflow
+if [ -c /dev/full ]; then
+    check "磁盘已满" test_disk_full "$T/basic.jdv"
+    check "磁盘已满（流式）" test_disk_full - <"$T/basic.jdv"
+fi
+
+head -c 100 "$T/basic.jdv" >"$T/truncated.jdv"
+check "截断的文件" test_corrupt "$T/truncated.jdv"
+check "截断的文件（流式）" test_corrupt - <"$T/truncated.jdv"
+check "页面指针形成环" test_corrupt "$T/cycle.jdv"
+check "页数多于总页数" test_corrupt "$T/pagecount.jdv"
+check "postamble中的字体定义损坏" test_postamble_fonts
+check "有错误的页" test_bad_page "$T/badpage.jdv"
+check "有错误的页（多线程）" test_bad_page -j 4 "$T/badpage.jdv"
+check "有错误的页（流式）" test_bad_page - <"$T/badpage.jdv"
+check "未定义的字体" test_undefined_font
+check "未定义的字体（多线程）" test_undefined_font -j 4
+check "字形号超出范围" test_big_glyph "$T/biggid.jdv"
+check "字形号超出范围（流式）" test_big_glyph - <"$T/biggid.jdv"
+check "出错后继续转换" test_library 1
+check "出错后继续转换（多线程）" test_library 4
+check "字体unitsPerEm为0" test_bad_font upem 无法载入字体
+check "字体hmtx项数为0" test_bad_font hmetrics 无法载入字体
+check "字体缺少hmtx表" test_bad_font nohmtx 无法载入字体
+check "字体name表超出范围" test_bad_font name 无法载入字体
+check "字体loca表超出范围" test_bad_font loca 无法输出字体
+check "版本0的OS/2表" test_bad_font os2 ""
+check "损坏的字体信息缓存" test_font_cache
+
+# 批量转换：出错的文件不影响其后的文件，最后报告出错的文件数并返回1
+test_batch()
+{
+    rm -rf "$T/batch"
+    mkdir "$T/batch" || return 1
+    cp "$T/truncated.jdv" "$T/batch/a.jdv"
+    cp "$T/basic.jdv" "$T/batch/b.jdv"
+    cp "$T/badpage.jdv" "$T/batch/c.jdv"
+    cp "$T/basic.jdv" "$T/batch/d.jdv"
+    if [ "$1" = list ]; then
+        for f in a b c d; do
+            printf '%s\t%s\n' "$T/batch/$f.jdv" "$T/batch/$f.pdf"
+        done >"$T/batch.txt"
+        "$JDVPDF" -j 4 --batch "$T/batch.txt" 2>"$T/batch.err"
+    else
+        "$JDVPDF" -j 4 --batch "$T/batch" 2>"$T/batch.err"
+    fi
+    status=$?
+    cat "$T/batch.err"
+    [ $status -eq 1 ] && grep -q '有2个文件转换失败' "$T/batch.err" || return 1
+    [ ! -e "$T/batch/a.pdf" ] && [ ! -e "$T/batch/c.pdf" ] || return 1
+    "$JDVTEST" checkxref "$T/batch/b.pdf" && "$JDVTEST" checkxref "$T/batch/d.pdf"
+}
+
+# 服务模式：套接字只有本用户可用；出错的请求回复ERROR，之后的请求照常处理；收到SIGTERM后退出
+test_server()
+{
+    "$JDVPDF" -j 4 --serve "$T/sock" 2>"$T/server.err" &
+    SERVER=$!
+    n=0
+    while [ ! -S "$T/sock" ] && [ $n -lt 100 ]; do
+        sleep 0.1
+        n=$((n + 1))
+    done
+    ls -l "$T/sock" | grep -q '^srw-------' || { ls -l "$T/sock"; return 1; }
+    {
+        "$JDVTEST" request "$T/sock" "$(printf '%s\t%s' "$T/truncated.jdv" "$T/s1.pdf")"
+        "$JDVTEST" request "$T/sock" "$(printf '%s\t%s' "$T/basic.jdv" "$T/s2.pdf")"
+        "$JDVTEST" request "$T/sock" "$(printf '%s\t%s' "$T/badpage.jdv" "$T/s3.pdf")"
+        "$JDVTEST" request "$T/sock" "$(printf '%s\t%s' - "$T/s4.pdf")" "$T/badpage.jdv"
+        "$JDVTEST" request "$T/sock" "$(printf '%s\t%s\t%s' - "$T/s5.pdf" 2-3)" "$T/basic.jdv"
+    } >"$T/replies.txt"
+    printf 'ERROR\nOK\nERROR\nERROR\nOK\n' | cmp - "$T/replies.txt" || { cat "$T/replies.txt"; return 1; }
+    grep -qa '/Count 2>>' "$T/s5.pdf" || return 1
+    kill -TERM $SERVER
+    wait $SERVER
+    status=$?
+    SERVER=
+    [ $status -eq 0 ] && [ ! -e "$T/sock" ]
+}
+
+check "批量转换（列表）" test_batch list
+check "批量转换（目录）" test_batch directory
+check "服务模式" test_server
+
+echo "通过$passed项，失败$failed项。"
+[ $failed -eq 0 ]
@@ -0,0 +1,827 @@
+//
+// Created by david on 2026/10/17.
+//
+
+/*
+ * 测试用的工具，由check.sh调用：
+ *     jdvTest write 种类 输出文件 字体文件     生成测试用的JDV文件
+ *     jdvTest badfont 种类 字体文件 输出文件   把TrueType字体改成各种损坏的样子，检查载入和子集化时的范围检查
+ *     jdvTest checkxref PDF文件                检查交叉引用表（或未压缩的交叉引用流）中的各位置
+ *     jdvTest cffindex                         检查CFF INDEX模型可以重复写出
+ *     jdvTest cidfont 输出文件                 生成只有空字形的CID字体（OTF）
+ *     jdvTest checkcid PDF文件                 检查嵌入的CID字体中CharStrings和Private DICT的位置
+ *     jdvTest convert 线程数 JDV文件...        在同一进程中用库函数依次转换，每个文件输出OK或ERROR
+ *     jdvTest request 套接字 请求 [JDV文件]    向服务模式的jdvpdf发送一个请求（及JDV文件的内容），输出回复
+ * 生成的JDV文件以0.001bp为单位，使pdf:content输出的坐标恰好是各寄存器的值。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../byteBuffer.h"
+#include "../byteSink.h"
+#include "../cffReader.h"
+#include "../cffWriter.h"
+#include "../fontObject.h"
+#include "../threadPool.h"
+#include "../jdvpdf.h"
+
+// 按大端序写入size字节
+static void put(ByteBuffer* b, int64_t val, int size)
+{
+    for (int i=size-1; i>=0; --i)
+        byteBufferPutc(b, (char) (uint8_t) (val >> (8 * i)));
+}
+
+static void putOp(ByteBuffer* b, int op, int64_t val, int size)
+{
+    byteBufferPutc(b, (char) op);
+    put(b, val, size);
+}
+
+static void putSpecial(ByteBuffer* b, const char* str)
+{
+    putOp(b, 239, strlen(str), 1); // xxx1
+    byteBufferPuts(b, str);
+}
+
+// fnt_def1或fnt_def2，字体大小为10bp
+static void putFontDef(ByteBuffer* b, int number, const char* font)
+{
+    if (number < 256) putOp(b, 243, number, 1);
+    else putOp(b, 244, number, 2);
+    put(b, 0, 4); // checksum
+    put(b, 10000, 4);
+    put(b, 10000, 4);
+    put(b, 0, 1);
+    put(b, strlen(font), 1);
+    byteBufferPuts(b, font);
+}
+
+// 以1000为1bp：num/den=254000/72000，mag=1000
+static void putPreamble(ByteBuffer* b)
+{
+    putOp(b, 247, 2, 1);
+    put(b, 254000, 4);
+    put(b, 72000, 4);
+    put(b, 1000, 4);
+    put(b, 4, 1);
+    byteBufferPuts(b, "test");
+}
+
+// BOP，c0为页码
+static size_t putBop(ByteBuffer* b, int page, int64_t last)
+{
+    size_t here = b->size;
+    putOp(b, 139, page, 4);
+    put(b, 0, 36);
+    put(b, last, 4);
+    return here;
+}
+
+static void putPostamble(ByteBuffer* b, int64_t last, int numPages, int numFonts, const int* fontNumbers,
+                         const char* font)
+{
+    size_t post = b->size;
+    putOp(b, 248, last, 4);
+    put(b, 254000, 4);
+    put(b, 72000, 4);
+    put(b, 1000, 4);
+    put(b, 842000, 4);
+    put(b, 595000, 4);
+    put(b, 2, 2);
+    put(b, numPages, 2);
+    for (int i=0; i<numFonts; ++i)
+        putFontDef(b, fontNumbers[i], font);
+    putOp(b, 249, post, 4);
+    put(b, 2, 1);
+    int fill = 0; // 4～7个223，使文件长度为4的倍数
+    do ++fill, byteBufferPutc(b, (char) 223);
+    while (fill < 4 || b->size % 4);
+}
+
+/*
+ * 3页，每页两行文字（ABC及其下一行的DE）、一条规则和一个pdf:literal。
+ * 同一行的字形应合并为一个TJ，整页只需一个Tf。
+ * badPage不为0时，该页多一个pop，文件结构完好，但解释该页时出错。
+ * noFontPage不为0时，该页选定未定义的字体5。
+ * bigGlyphPage不为0时，该页还有一个GID为0x10000的字形，超出Identity-H的范围。
+ */
+static void writeBasic(ByteBuffer* b, const char* font, int badPage, int noFontPage, int bigGlyphPage)
+{
+    static const int fonts[] = {0};
+    int64_t last = -1;
+    putPreamble(b);
+    for (int page=1; page<=3; ++page)
+    {
+        last = putBop(b, page, last);
+        if (page == 1) putFontDef(b, 0, font);
+        putOp(b, 160, 100000, 4); // down4 100bp
+        byteBufferPutc(b, (char) 141); // push
+        byteBufferPutc(b, (char) (page == noFontPage ? 176 : 171)); // fnt_num_5或fnt_num_0
+        byteBufferPuts(b, "\x24\x25\x26"); // set_char：GID 36～38
+        if (page == bigGlyphPage) putOp(b, 130, 0x10000, 3); // set3
+        byteBufferPutc(b, (char) 142); // pop
+        if (page == badPage) byteBufferPutc(b, (char) 142);
+        putOp(b, 160, 20000, 4);
+        byteBufferPuts(b, "\x27\x28");
+        putOp(b, 132, 500, 4); // set_rule
+        put(b, 100000, 4);
+        putSpecial(b, "pdf:literal % literal");
+        byteBufferPutc(b, (char) 140); // eop
+    }
+    putPostamble(b, last, 3, 1, fonts, font);
+}
+
+/*
+ * 1页，用到各种长度的命令，其间用pdf:content输出当前位置：
+ *     right1～4之后：h=101000，即(101.000, 842.000)
+ *     w0～w4、x0～x4之后：h=301000，即(301.000, 842.000)
+ *     down1～4之后：v=101000，即(301.000, 741.000)
+ *     y0～y4、z0～z4之后：v=301000，即(301.000, 541.000)
+ *     pop之后：(0.000, 842.000)
+ * 最后一行文字依次为set_char、set1、set2、set3、put1、put2，GID为65、200、300、257、66、400。
+ */
+static void writeOpcodes(ByteBuffer* b, const char* font)
+{
+    static const int fonts[] = {0, 300};
+    putPreamble(b);
+    size_t bop = putBop(b, 1, -1);
+    putFontDef(b, 0, font);
+    putFontDef(b, 300, font);
+    byteBufferPutc(b, (char) 141); // push
+
+    putOp(b, 143, 10, 1);
+    putOp(b, 144, 1000, 2);
+    putOp(b, 145, 100000, 3);
+    putOp(b, 146, -10, 4);
+    putSpecial(b, "pdf:content % right");
+
+    putOp(b, 148, 5, 1);
+    byteBufferPutc(b, (char) 147);
+    putOp(b, 149, 1000, 2);
+    putOp(b, 150, 100000, 3);
+    putOp(b, 151, -10, 4);
+    byteBufferPutc(b, (char) 147);
+    putOp(b, 153, 5, 1);
+    byteBufferPutc(b, (char) 152);
+    putOp(b, 154, 1000, 2);
+    putOp(b, 155, 100000, 3);
+    putOp(b, 156, -1000, 4);
+    byteBufferPutc(b, (char) 152);
+    putSpecial(b, "pdf:content % wx");
+
+    putOp(b, 157, 10, 1);
+    putOp(b, 158, 1000, 2);
+    putOp(b, 159, 100000, 3);
+    putOp(b, 160, -10, 4);
+    putSpecial(b, "pdf:content % down");
+
+    putOp(b, 162, 5, 1);
+    byteBufferPutc(b, (char) 161);
+    putOp(b, 163, 1000, 2);
+    putOp(b, 164, 100000, 3);
+    putOp(b, 165, -10, 4);
+    byteBufferPutc(b, (char) 161);
+    putOp(b, 167, 5, 1);
+    byteBufferPutc(b, (char) 166);
+    putOp(b, 168, 1000, 2);
+    putOp(b, 169, 100000, 3);
+    putOp(b, 170, -1000, 4);
+    byteBufferPutc(b, (char) 166);
+    putSpecial(b, "pdf:content % yz");
+
+    byteBufferPutc(b, (char) 142); // pop
+    byteBufferPutc(b, (char) 138); // nop
+    putSpecial(b, "pdf:content % pop");
+
+    putOp(b, 160, 500000, 4);
+    putOp(b, 236, 300, 2); // fnt2
+    byteBufferPutc(b, (char) 65);
+    putOp(b, 128, 200, 1);
+    putOp(b, 129, 300, 2);
+    putOp(b, 130, 257, 3);
+    putOp(b, 133, 66, 1);
+    putOp(b, 134, 400, 2);
+    byteBufferPutc(b, (char) 140);
+    putPostamble(b, bop, 1, 2, fonts, font);
+}
+
+// 按大端序改写已写入的size字节
+static void patch(ByteBuffer* b, size_t at, int64_t val, int size)
+{
+    for (int i=size-1; i>=0; --i, val >>= 8)
+        b->data[at + i] = (char) (uint8_t) val;
+}
+
+// 由文件尾找到postamble的位置
+static size_t findPostamble(const ByteBuffer* b)
+{
+    size_t end = b->size;
+    while (end > 0 && (uint8_t) b->data[end - 1] == 223) --end;
+    const uint8_t* p = (const uint8_t*) b->data + end - 5;
+    return (size_t) p[0] << 24 | (size_t) p[1] << 16 | (size_t) p[2] << 8 | p[3];
+}
+
+/*
+ * 种类：
+ *     basic、opcodes：见writeBasic、writeOpcodes
+ *     badpage：basic的第2页多一个pop
+ *     cycle：basic的第1页的BOP指向自己，各页的指针形成环
+ *     pagecount：basic的postamble中总页数为2，少于实际的页数
+ *     postfonts：basic的postamble中第一个字体定义被改为push，须扫描整个文件
+ *     nofont：basic的第2页选定未定义的字体5
+ *     biggid：basic的第3页有GID为0x10000的字形
+ */
+static int writeFixture(const char* kind, const char* outName, const char* font)
+{
+    ByteBuffer b;
+    byteBufferConstruct(&b);
+    if (!strcmp(kind, "basic")) writeBasic(&b, font, 0, 0, 0);
+    else if (!strcmp(kind, "badpage")) writeBasic(&b, font, 2, 0, 0);
+    else if (!strcmp(kind, "nofont")) writeBasic(&b, font, 0, 2, 0);
+    else if (!strcmp(kind, "biggid")) writeBasic(&b, font, 0, 0, 3);
+    else if (!strcmp(kind, "cycle"))
+    {
+        writeBasic(&b, font, 0, 0, 0);
+        patch(&b, 19 + 41, 19, 4); // 第1页的BOP紧接在19字节的preamble之后
+    }
+    else if (!strcmp(kind, "pagecount"))
+    {
+        writeBasic(&b, font, 0, 0, 0);
+        patch(&b, findPostamble(&b) + 27, 2, 2);
+    }
+    else if (!strcmp(kind, "postfonts"))
+    {
+        writeBasic(&b, font, 0, 0, 0);
+        patch(&b, findPostamble(&b) + 29, 141, 1);
+    }
+    else if (!strcmp(kind, "opcodes")) writeOpcodes(&b, font);
+    else
+    {
+        fprintf(stderr, "没有这种测试文件：%s\n", kind);
+        return 1;
+    }
+    FILE* out = fopen(outName, "wb");
+    int failed = !out || fwrite(b.data, 1, b.size, out) != b.size;
+    if (out && fclose(out)) failed = 1;
+    byteBufferDestruct(&b);
+    return failed;
+}
+
+static char* readFile(const char* name, size_t* size)
+{
+    FILE* f = fopen(name, "rb");
+    if (!f) return NULL;
+    ByteBuffer b;
+    byteBufferConstruct(&b);
+    char chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        byteBufferWrite(&b, chunk, got);
+    fclose(f);
+    byteBufferPutc(&b, 0); // 便于用字符串函数查找
+    *size = b.size - 1;
+    return b.data;
+}
+
+// 检查offset处是否为num号对象的开头
+static int isObjectAt(const char* pdf, size_t size, uint64_t offset, unsigned num)
+{
+    char head[32];
+    int length = snprintf(head, sizeof(head), "%u 0 obj", num);
+    return offset + length <= size && !memcmp(pdf + offset, head, length);
+}
+
+/**
+ * 检查交叉引用表或交叉引用流中的各项是否指向相应的对象。交叉引用流须未压缩（-z 0）。
+ * @return 全部正确时为0
+ */
+static int checkXref(const char* name)
+{
+    size_t size;
+    char* pdf = readFile(name, &size);
+    if (!pdf)
+    {
+        fprintf(stderr, "无法读取%s\n", name);
+        return 1;
+    }
+    int errors = 0;
+    const char* p = NULL; // 最后一个startxref；字体等stream中可能有0字节，不能用strstr
+    for (size_t i = size >= 10 ? size - 10 : 0; !p && i-- > 0;)
+        if (!memcmp(pdf + i, "startxref\n", 10)) p = pdf + i;
+    uint64_t xrefPos = p ? strtoull(p + 10, NULL, 10) : size;
+    if (xrefPos >= size)
+    {
+        fputs("找不到startxref\n", stderr);
+        free(pdf);
+        return 1;
+    }
+
+    if (!strncmp(pdf + xrefPos, "xref\n", 5)) // 交叉引用表
+    {
+        unsigned first, count;
+        p = pdf + xrefPos + 5;
+        if (sscanf(p, "%u %u", &first, &count) != 2 || first != 0) ++errors;
+        else
+        {
+            p = strchr(p, '\n') + 1;
+            for (unsigned i=0; i<count; ++i, p += 20)
+            {
+                if (p + 20 > pdf + size || p[17] != (i ? 'n' : 'f') || p[19] != '\n')
+                {
+                    fprintf(stderr, "交叉引用表第%u项格式有误\n", i);
+                    ++errors;
+                    break;
+                }
+                if (i && !isObjectAt(pdf, size, strtoull(p, NULL, 10), i))
+                {
+                    fprintf(stderr, "交叉引用表第%u项的位置有误\n", i);
+                    ++errors;
+                }
+            }
+        }
+    }
+    else // 交叉引用流
+    {
+        const char* dict = strstr(pdf + xrefPos, "<<");
+        const char* stream = dict ? strstr(dict, ">>\nstream\n") : NULL;
+        int w[3];
+        unsigned count;
+        if (!stream || !strstr(dict, "/Type /XRef") || (p = strstr(dict, "/W [")) == NULL || p > stream ||
+                sscanf(p, "/W [%d %d %d]", w, w + 1, w + 2) != 3 || (p = strstr(dict, "/Size ")) == NULL ||
+                sscanf(p, "/Size %u", &count) != 1 || w[0] != 1 || w[1] < 1 || w[1] > 8 || w[2] < 0 || w[2] > 8)
+        {
+            fputs("交叉引用流的字典有误\n", stderr);
+            free(pdf);
+            return 1;
+        }
+        const char* filter = strstr(dict, "/Filter");
+        if (filter && filter < stream)
+        {
+            fputs("交叉引用流已压缩，须用-z 0检查\n", stderr);
+            free(pdf);
+            return 1;
+        }
+        const uint8_t* data = (const uint8_t*) stream + 10;
+        size_t entrySize = w[0] + w[1] + w[2];
+        if (data + count * entrySize > (const uint8_t*) pdf + size)
+        {
+            fputs("交叉引用流不完整\n", stderr);
+            free(pdf);
+            return 1;
+        }
+        for (unsigned i=1; i<count; ++i)
+        {
+            const uint8_t* e = data + i * entrySize;
+            uint64_t field[3] = {0, 0, 0};
+            for (int k=0, pos=0; k<3; pos += w[k++])
+                for (int j=0; j<w[k]; ++j)
+                    field[k] = field[k] << 8 | e[pos + j];
+            if (field[0] == 1 && !isObjectAt(pdf, size, field[1], i))
+            {
+                fprintf(stderr, "交叉引用流第%u项的位置有误\n", i);
+                ++errors;
+            }
+            else if (field[0] == 2) // 在对象流中，对象流本身须直接在文件中
+            {
+                uint64_t offset = 0;
+                if (field[1] < count)
+                {
+                    const uint8_t* s = data + field[1] * entrySize;
+                    if (s[0] == 1)
+                        for (int j=0; j<w[1]; ++j)
+                            offset = offset << 8 | s[w[0] + j];
+                }
+                if (!offset || !isObjectAt(pdf, size, offset, field[1]) ||
+                        strncmp(strchr(pdf + offset, '\n') + 1, "<</Type /ObjStm", 15))
+                {
+                    fprintf(stderr, "交叉引用流第%u项所在的对象流有误\n", i);
+                    ++errors;
+                }
+            }
+            else if (field[0] != 1 && field[0] != 2)
+            {
+                fprintf(stderr, "交叉引用流第%u项的类型有误\n", i);
+                ++errors;
+            }
+        }
+    }
+    free(pdf);
+    return errors != 0;
+}
+
+// 在TrueType字体的表索引中查找，返回该表的索引项，没有时为NULL
+static uint8_t* findFontTable(uint8_t* font, size_t size, const char* tag)
+{
+    unsigned numTables = size < 12 ? 0 : (font[4] << 8) | font[5];
+    for (unsigned i = 0; i < numTables && 12 + 16 * (i + 1) <= size; ++i)
+        if (!memcmp(font + 12 + 16 * i, tag, 4)) return font + 12 + 16 * i;
+    return NULL;
+}
+
+/*
+ * 种类：
+ *     upem：head表中unitsPerEm为0
+ *     hmetrics：hhea表中numberOfHMetrics为0
+ *     nohmtx：hmtx表的Tag改为hmtz，使字体缺少hmtx表
+ *     name：name表中的项数超出表的范围
+ *     os2：OS/2表截短为版本0的78字节，没有sCapHeight（仍可使用）
+ *     loca：loca表中第2个字形的位置超出glyf表
+ */
+static int writeBadFont(const char* kind, const char* inName, const char* outName)
+{
+    size_t size;
+    uint8_t* font = (uint8_t*) readFile(inName, &size);
+    if (!font) return 1;
+    const char* tags[6][2] = {
+            {"upem", "head"}, {"hmetrics", "hhea"}, {"nohmtx", "hmtx"}, {"name", "name"}, {"os2", "OS/2"}, {"loca", "loca"}
+    };
+    int k = 0;
+    while (k < 6 && strcmp(kind, tags[k][0])) ++k;
+    uint8_t* record = k < 6 ? findFontTable(font, size, tags[k][1]) : NULL;
+    if (!record)
+    {
+        fprintf(stderr, "没有这种测试字体：%s\n", kind);
+        free(font);
+        return 1;
+    }
+    uint32_t offset = (uint32_t) record[8] << 24 | record[9] << 16 | record[10] << 8 | record[11];
+    if (offset > size - 36)
+    {
+        free(font);
+        return 1;
+    }
+    uint8_t* table = font + offset;
+    switch (k)
+    {
+        case 0: table[18] = table[19] = 0; break;
+        case 1: table[34] = table[35] = 0; break;
+        case 2: record[3] = 'z'; break;
+        case 3: table[2] = table[3] = 0xFF; break;
+        case 4: record[12] = record[13] = record[14] = 0; record[15] = 78; break;
+        default: memset(table + 4, 0xFF, 4); break; // 长式时为第2项，短式时为第2、3项
+    }
+    FILE* out = fopen(outName, "wb");
+    int failed = !out || fwrite(font, 1, size, out) != size;
+    if (out && fclose(out)) failed = 1;
+    free(font);
+    return failed;
+}
+
+#define CID_FONT_GLYPHS 64
+#define CID_FONT_PRIVATE 115 // Private DICT的位置，在Font DICT中以2字节的整数表示
+
+// 写入CFF DICT中的5字节整数
+static void putDictInt5(ByteBuffer* b, int32_t val)
+{
+    byteBufferPutc(b, 29);
+    put(b, val, 4);
+}
+
+/**
+ * 生成CID字体的CFF表，各字形都是空的（只有endchar）。Private DICT在Global Subr INDEX之后，
+ * 子集中Top DICT的整数改为最短的形式后前移，其位置不能再以原来的2字节表示。
+ */
+static void writeCidCff(ByteBuffer* cff)
+{
+    byteBufferWrite(cff, "\1\0\4\4", 4); // Header
+    byteBufferWrite(cff, "\0\1\1\1\x08" "TestCID", 12); // Name INDEX
+
+    // Top DICT INDEX，其中的整数都是5字节，共50字节；各偏移量最后再填
+    byteBufferWrite(cff, "\0\1\1\1\x33", 5);
+    putDictInt5(cff, 391); // Adobe
+    putDictInt5(cff, 392); // Identity
+    putDictInt5(cff, 0);
+    byteBufferWrite(cff, "\x0C\x1E", 2); // ROS
+    putDictInt5(cff, CID_FONT_GLYPHS);
+    byteBufferWrite(cff, "\x0C\x22", 2); // CIDCount
+    size_t refs = cff->size;
+    putDictInt5(cff, 0);
+    byteBufferPutc(cff, 15); // charset
+    putDictInt5(cff, 0);
+    byteBufferWrite(cff, "\x0C\x25", 2); // FDSelect
+    putDictInt5(cff, 0);
+    byteBufferPutc(cff, 17); // CharStrings
+    putDictInt5(cff, 0);
+    byteBufferWrite(cff, "\x0C\x24", 2); // FDArray
+
+    // String INDEX，第3个字符串只用来使Private DICT在CID_FONT_PRIVATE处；其后是空的Global Subr INDEX
+    byteBufferWrite(cff, "\0\3\1\1\6\x0E\x24" "AdobeIdentity----------------------", 42);
+    byteBufferWrite(cff, "\0\0", 2);
+    byteBufferWrite(cff, "\x8B\x14", 2); // Private DICT：defaultWidthX 0
+
+    size_t offsets[4];
+    offsets[0] = cff->size; // charset，格式2
+    byteBufferPutc(cff, 2);
+    put(cff, 1, 2);
+    put(cff, CID_FONT_GLYPHS - 2, 2);
+    offsets[1] = cff->size; // FDSelect，格式3
+    byteBufferPutc(cff, 3);
+    put(cff, 1, 2);
+    put(cff, 0, 3);
+    put(cff, CID_FONT_GLYPHS, 2);
+    offsets[2] = cff->size; // CharStrings INDEX
+    put(cff, CID_FONT_GLYPHS, 2);
+    byteBufferPutc(cff, 1);
+    for (int i = 0; i <= CID_FONT_GLYPHS; ++i)
+        byteBufferPutc(cff, (char) (i + 1));
+    for (int i = 0; i < CID_FONT_GLYPHS; ++i)
+        byteBufferPutc(cff, 14); // endchar
+    offsets[3] = cff->size; // FDArray，Font DICT中Private的大小为2
+    byteBufferWrite(cff, "\0\1\1\1\5\x8D", 6);
+    byteBufferPutc(cff, (char) 247);
+    byteBufferPutc(cff, CID_FONT_PRIVATE - 108);
+    byteBufferPutc(cff, 18);
+
+    uint8_t* p = (uint8_t*) cff->data + refs;
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+            p[1 + j] = (uint8_t) (offsets[i] >> (24 - 8 * j));
+        p += p[5] == 12 ? 7 : 6; // 跳过整数和命令
+    }
+}
+
+/**
+ * 生成只有CFF、head、hhea、hmtx和maxp表的CID字体，见writeCidCff。
+ * @return 成功时为0
+ */
+static int writeCidFont(const char* outName)
+{
+    ByteBuffer tables[5];
+    for (int i = 0; i < 5; ++i)
+        byteBufferConstruct(tables + i);
+    writeCidCff(tables);
+    put(tables + 1, 0x00010000, 4); // head
+    put(tables + 1, 0, 14);
+    put(tables + 1, 1000, 2); // unitsPerEm
+    put(tables + 1, 0, 16);
+    put(tables + 1, 0, 2);
+    put(tables + 1, -200, 2);
+    put(tables + 1, 1000, 2);
+    put(tables + 1, 800, 2); // FontBBox
+    put(tables + 1, 0, 10);
+    put(tables + 2, 0x00010000, 4); // hhea
+    put(tables + 2, 800, 2);
+    put(tables + 2, -200, 2);
+    put(tables + 2, 0, 26);
+    put(tables + 2, 1, 2); // numberOfHMetrics
+    put(tables + 3, 500, 2); // hmtx
+    put(tables + 3, 0, 2);
+    put(tables + 4, 0x00005000, 4); // maxp
+    put(tables + 4, CID_FONT_GLYPHS, 2);
+
+    static const char tags[5][5] = {"CFF ", "head", "hhea", "hmtx", "maxp"};
+    ByteBuffer font;
+    byteBufferConstruct(&font);
+    byteBufferWrite(&font, "OTTO", 4);
+    put(&font, 5, 2);
+    put(&font, 0, 6);
+    uint32_t offset = 12 + 16 * 5;
+    for (int i = 0; i < 5; ++i)
+    {
+        byteBufferWrite(&font, tags[i], 4);
+        put(&font, 0, 4);
+        put(&font, offset, 4);
+        put(&font, tables[i].size, 4);
+        offset += (tables[i].size + 3) & ~3u;
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+        byteBufferWrite(&font, tables[i].data, tables[i].size);
+        put(&font, 0, -tables[i].size & 3);
+        byteBufferDestruct(tables + i);
+    }
+    FILE* out = fopen(outName, "wb");
+    int failed = !out || fwrite(font.data, 1, font.size, out) != font.size;
+    if (out && fclose(out)) failed = 1;
+    byteBufferDestruct(&font);
+    return failed;
+}
+
+// 取出DICT中某个命令之前的第n个（从后往前数，从0开始）操作数，没有时为-1
+static int32_t dictOperand(const CffDict* dict, int32_t op, int n)
+{
+    for (CffDictItem* it = dict->begin; it != dict->end; ++it)
+        if (it->type == CFF_DICT_COMMAND && it->content.data == op)
+            return it - dict->begin > n && it[-1 - n].type == CFF_DICT_INTEGER ? it[-1 - n].content.data : -1;
+    return -1;
+}
+
+/**
+ * 检查PDF中嵌入的CFF（须未压缩，-z 0）：CharStrings的位置指向字形数正确的INDEX，
+ * FDArray中Private的位置指向writeCidCff中的Private DICT。
+ * @return 正确时为0
+ */
+static int checkCidFont(const char* name)
+{
+    size_t size;
+    char* pdf = readFile(name, &size);
+    if (!pdf) return 1;
+    static const char begin[] = "/Subtype /CIDFontType0C>>\nstream\n";
+    const char* p = NULL; // 字体等stream中可能有0字节，不能用strstr
+    for (size_t i = 0; !p && i + sizeof(begin) - 1 <= size; ++i)
+        if (!memcmp(pdf + i, begin, sizeof(begin) - 1)) p = pdf + i + sizeof(begin) - 1;
+    const char* streamEnd = NULL;
+    for (size_t i = p ? (size_t) (p - pdf) : size; !streamEnd && i + 10 <= size; ++i)
+        if (!memcmp(pdf + i, "\nendstream", 10)) streamEnd = pdf + i;
+    if (!streamEnd)
+    {
+        fputs("没有找到嵌入的CFF\n", stderr);
+        free(pdf);
+        return 1;
+    }
+    const uint8_t* cff = (const uint8_t*) p;
+    const uint8_t* end = (const uint8_t*) streamEnd;
+
+    int errors = 0;
+    CffIndex index;
+    const uint8_t* topDictData;
+    long topDictSize;
+    if (!cffIndexExtractChecked(cff + cff[2], end, &index) ||
+            !cffIndexExtractChecked(cffIndexSkip(&index), end, &index) || index.count != 1)
+    {
+        fputs("CFF的Name INDEX或Top DICT INDEX有误\n", stderr);
+        free(pdf);
+        return 1;
+    }
+    cffIndexFindObject(&index, 0, &topDictData, &topDictSize);
+    CffDict topDict;
+    cffDictConstruct(topDictData, topDictSize, &topDict);
+    int32_t charStrings = dictOperand(&topDict, 17, 0);
+    int32_t fdArray = dictOperand(&topDict, 0xC24, 0);
+    cffDictDestruct(&topDict);
+
+    if (charStrings < 0 || charStrings >= end - cff || !cffIndexExtractChecked(cff + charStrings, end, &index) ||
+            index.count != CID_FONT_GLYPHS)
+    {
+        fputs("CharStrings的位置有误\n", stderr);
+        ++errors;
+    }
+    const uint8_t* fontDictData;
+    long fontDictSize;
+    if (fdArray < 0 || fdArray >= end - cff || !cffIndexExtractChecked(cff + fdArray, end, &index) ||
+            index.count != 1)
+    {
+        fputs("FDArray的位置有误\n", stderr);
+        free(pdf);
+        return 1;
+    }
+    cffIndexFindObject(&index, 0, &fontDictData, &fontDictSize);
+    CffDict fontDict;
+    cffDictConstruct(fontDictData, fontDictSize, &fontDict);
+    int32_t privateOffset = dictOperand(&fontDict, 18, 0);
+    int32_t privateSize = dictOperand(&fontDict, 18, 1);
+    cffDictDestruct(&fontDict);
+    if (privateSize != 2 || privateOffset < 0 || privateOffset > end - cff - 2 ||
+            memcmp(cff + privateOffset, "\x8B\x14", 2))
+    {
+        fprintf(stderr, "Private DICT的位置%d有误\n", privateOffset);
+        ++errors;
+    }
+    free(pdf);
+    return errors != 0;
+}
+
+/**
+ * 把一个含有空对象的INDEX模型写出两次，两次的结果应相同，且偏移量正确。
+ * @return 正确时为0
+ */
+static int checkCffIndex()
+{
+    CffIndexModel model;
+    cffIndexModelConstruct(&model);
+    cffIndexModelAppendEmpty(&model, 2);
+    cffIndexModelAppend(&model, cffObjectNodeFromMemory("ab", 2));
+    cffIndexModelAppendEmpty(&model, 3);
+    ByteSink first, second;
+    byteSinkConstruct(&first, NULL);
+    byteSinkConstruct(&second, NULL);
+    cffIndexModelWriteToSink(&model, &first);
+    cffIndexModelWriteToSink(&model, &second);
+    cffIndexModelDestruct(&model);
+
+    // count为6，offSize为1，偏移量为1 1 1 3 3 3 3，其后是对象
+    static const uint8_t expected[] = {0, 6, 1, 1, 1, 1, 3, 3, 3, 3, 'a', 'b'};
+    int failed = first.buffer.size != sizeof(expected) || memcmp(first.buffer.data, expected, sizeof(expected)) ||
+            second.buffer.size != sizeof(expected) || memcmp(second.buffer.data, expected, sizeof(expected));
+    if (failed) fputs("INDEX的输出有误\n", stderr);
+    byteSinkDestruct(&first);
+    byteSinkDestruct(&second);
+    return failed;
+}
+
+/**
+ * 在同一进程中用库函数依次转换各文件，每个文件输出一行OK或ERROR。
+ * 用于检查出错的转换不会退出程序，也不影响之后的转换。
+ * @param numThreads 线程池的线程数，为1时不用线程池
+ * @return 各文件都能读取，且成功的转换都生成了完整的PDF文件时为0
+ */
+static int convertFiles(int numThreads, int numFiles, char* names[])
+{
+    int errors = 0;
+    JdvpdfOptions o;
+    jdvpdfDefaultOptions(&o);
+    initiateFontLibrary();
+    o.pool = numThreads > 1 ? threadPoolNew(numThreads) : NULL;
+    for (int i=0; i<numFiles; ++i)
+    {
+        size_t size;
+        char* jdv = readFile(names[i], &size);
+        if (!jdv)
+        {
+            fprintf(stderr, "无法读取%s\n", names[i]);
+            ++errors;
+            continue;
+        }
+        ByteBuffer pdf;
+        byteBufferConstruct(&pdf);
+        if (jdvpdfConvertToBuffer(jdv, size, &pdf, &o))
+        {
+            fputs("\n", stderr);
+            puts(pdf.size ? "ERROR（缓冲区被改动）" : "ERROR");
+            errors += pdf.size != 0;
+        }
+        else if (pdf.size < 14 || memcmp(pdf.data, "%PDF-", 5) || memcmp(pdf.data + pdf.size - 5, "%%EOF", 5))
+        {
+            puts("OK（PDF文件不完整）");
+            ++errors;
+        }
+        else
+            puts("OK");
+        byteBufferDestruct(&pdf);
+        free(jdv);
+    }
+    if (o.pool) threadPoolFree(o.pool);
+    deleteFontLibrary();
+    return errors != 0;
+}
+
+/**
+ * 向服务模式的jdvpdf发送一行请求，请求中输入文件为“-”时再发送jdvName的内容，然后输出回复。
+ * @return 能连接并收到回复时为0
+ */
+static int sendRequest(const char* path, const char* request, const char* jdvName)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return 1;
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0)
+    {
+        fprintf(stderr, "无法连接%s\n", path);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    ByteBuffer b;
+    byteBufferConstruct(&b);
+    byteBufferPuts(&b, request);
+    byteBufferPutc(&b, '\n');
+    if (jdvName)
+    {
+        size_t size;
+        char* jdv = readFile(jdvName, &size);
+        if (jdv) byteBufferWrite(&b, jdv, size);
+        free(jdv);
+    }
+    int failed = write(fd, b.data, b.size) != (ssize_t) b.size;
+    byteBufferDestruct(&b);
+    shutdown(fd, SHUT_WR);
+
+    char reply[64];
+    ssize_t got = failed ? -1 : read(fd, reply, sizeof(reply) - 1);
+    close(fd);
+    if (got <= 0) return 1;
+    fwrite(reply, 1, got, stdout);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 5 && !strcmp(argv[1], "write")) return writeFixture(argv[2], argv[3], argv[4]);
+    if (argc == 5 && !strcmp(argv[1], "badfont")) return writeBadFont(argv[2], argv[3], argv[4]);
+    if (argc == 2 && !strcmp(argv[1], "cffindex")) return checkCffIndex();
+    if (argc == 3 && !strcmp(argv[1], "cidfont")) return writeCidFont(argv[2]);
+    if (argc == 3 && !strcmp(argv[1], "checkcid")) return checkCidFont(argv[2]);
+    if (argc == 3 && !strcmp(argv[1], "checkxref")) return checkXref(argv[2]);
+    if (argc >= 4 && !strcmp(argv[1], "convert")) return convertFiles(atoi(argv[2]), argc - 3, argv + 3);
+    if ((argc == 4 || argc == 5) && !strcmp(argv[1], "request")) return sendRequest(argv[2], argv[3], argv[4]);
+    fputs("用法：jdvTest write 种类 输出文件 字体文件\n"
+          "      jdvTest badfont 种类 字体文件 输出文件\n"
+          "      jdvTest checkxref PDF文件\n"
+          "      jdvTest cffindex\n"
+          "      jdvTest cidfont 输出文件\n"
+          "      jdvTest checkcid PDF文件\n"
+          "      jdvTest convert 线程数 JDV文件...\n"
+          "      jdvTest request 套接字 请求 [JDV文件]\n", stderr);
+    return 2;
+}
@@ -0,0 +1,98 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "threadPool.h"
+
+struct TaskNode {
+    ThreadTask task;
+    void* arg;
+    struct TaskNode* next;
+};
+
+struct ThreadPool_ {
+    pthread_mutex_t lock;
+    pthread_cond_t hasTask;
+    struct TaskNode* head; // 任务队列，先进先出
+    struct TaskNode* tail;
+    _Bool stopping;
+    int numThreads;
+    pthread_t* threads;
+};
+
+static void* workerMain(void* arg)
+{
+    ThreadPool* pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (!pool->head && !pool->stopping)
+            pthread_cond_wait(&pool->hasTask, &pool->lock);
+        if (!pool->head) break; // 正在销毁且没有剩余任务
+
+        struct TaskNode* node = pool->head;
+        pool->head = node->next;
+        if (!pool->head) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        node->task(node->arg);
+        free(node);
+
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool* threadPoolNew(int numThreads)
+{
+    ThreadPool* pool = malloc(sizeof(ThreadPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->hasTask, NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->stopping = 0;
+    pool->numThreads = numThreads;
+    pool->threads = malloc(numThreads * sizeof(pthread_t));
+    for (int i=0; i<numThreads; ++i)
+        pthread_create(pool->threads + i, NULL, workerMain, pool);
+    return pool;
+}
+
+void threadPoolFree(ThreadPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->hasTask);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i=0; i<pool->numThreads; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->hasTask);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+void threadPoolSubmit(ThreadPool* pool, ThreadTask task, void* arg)
+{
+    struct TaskNode* node = malloc(sizeof(struct TaskNode));
+    node->task = task;
+    node->arg = arg;
+    node->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) pool->tail->next = node;
+    else pool->head = node;
+    pool->tail = node;
+    pthread_cond_signal(&pool->hasTask);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int threadPoolSize(const ThreadPool* pool)
+{
+    return pool->numThreads;
+}
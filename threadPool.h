@@ -0,0 +1,30 @@
+//
+// Created by david on 2026/10/17.
+//
+
+#ifndef JDVPDF_THREADPOOL_H
+#define JDVPDF_THREADPOOL_H
+
+typedef void (*ThreadTask)(void*);
+
+typedef struct ThreadPool_ ThreadPool;
+
+/**
+ * 创建线程池
+ * @param numThreads 工作线程数
+ */
+ThreadPool* threadPoolNew(int numThreads);
+
+/**
+ * 销毁线程池。已提交的任务会先全部执行完。
+ */
+void threadPoolFree(ThreadPool* pool);
+
+/**
+ * 提交一个任务，由某一工作线程执行task(arg)
+ */
+void threadPoolSubmit(ThreadPool* pool, ThreadTask task, void* arg);
+
+int threadPoolSize(const ThreadPool* pool);
+
+#endif //JDVPDF_THREADPOOL_H